@@ -1,140 +1,581 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define FILENAME		"ppc3_output.h"
 #define OUTPUT_NAME		"ppc3_output.bin"
-#define MAX_NUMBERS		8*1024
 #define CFG_META_DELAY		254
 #define CFG_META_BURST		253
 #define CFG_ASCII_TEXT		240
 //#define DSP_BOOK_ONLY		0xaa
 #define DSP_BOOK_ONLY		0x8c
+#define SYNTH_BURST					// rewrite the output with bursts
+#define PAGE_SEL		0x00
+#define BOOK_SEL		0x7f
+#define SWAP_BOOK		0x8c
+#define SWAP_PAGE		0x23
+#define SWAP_REG		0x14			// 4 bytes
+#define MAX_BURST		254			// values, length field is n + 1
+#define MAX_RATES		8
+#define CONTAINER_MAGIC		0x57465354		// "TSFW"
+#define CONTAINER_VERSION	1
 
-char* read_file(const char* filename) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Unable to open file");
-        exit(EXIT_FAILURE);
+struct numbers {
+    unsigned char *data;
+    size_t count, size;
+};
+
+void push_number(struct numbers *n, int num) {
+    if (n->count == n->size) {
+        n->size = n->size ? 2 * n->size : 4096;
+        n->data = realloc(n->data, n->size);
+        if (!n->data) {
+            perror("Unable to allocate buffer");
+            exit(EXIT_FAILURE);
+        }
     }
+    n->data[n->count++] = num;
+}
 
-    fseek(file, 0, SEEK_END);
-    long length = ftell(file);
-    fseek(file, 0, SEEK_SET);
+/* number at i, or -1 past the end so lookahead never matches */
+int number(const struct numbers *n, size_t i) {
+    return i < n->count ? n->data[i] : -1;
+}
 
-    char *buffer = malloc(length + 1);
-    if (!buffer) {
-        perror("Unable to allocate buffer");
-        exit(EXIT_FAILURE);
+int skip_space(FILE *file) {
+    int c;
+
+    while (isspace(c = getc(file)))
+        ;
+    return c;
+}
+
+/*
+ * Single pass over the PPC3 header: a hex value counts when it follows '{' or
+ * ',' (as in "{ 0x00, 0x00 }"), and "{ CFG_META_BURST, n }" and
+ * "{ CFG_META_DELAY, n }" become a command byte and its parameter. Everything
+ * else, typedefs and comments included, is skipped.
+ */
+void parse_hex_numbers(FILE *file, struct numbers *n) {
+    char word[32];
+    int c, prev = 0, num;
+    unsigned int len;
+
+    n->count = 0;
+    c = getc(file);
+    while (c != EOF) {
+        if (isspace(c)) {
+            c = getc(file);
+            continue;
+        }
+        if ((c == '{') || (c == ',')) {
+            prev = c;
+            c = getc(file);
+            continue;
+        }
+        if ((c == '0') && prev) {
+            prev = 0;
+            c = getc(file);
+            if ((c != 'x') && (c != 'X'))
+                continue;
+            c = getc(file);
+            if (!isxdigit(c))
+                continue;
+            for (num = 0; isxdigit(c); c = getc(file))
+                num = (num << 4) | (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+            push_number(n, num);
+            continue;
+        }
+        if (isalpha(c) || (c == '_')) {
+            for (len = 0; isalnum(c) || (c == '_'); c = getc(file))
+                if (len < sizeof(word) - 1)
+                    word[len++] = c;
+            word[len] = '\0';
+            if (prev != '{') {
+                prev = 0;
+                continue;
+            }
+            prev = 0;
+            if (strcmp(word, "CFG_META_BURST") && strcmp(word, "CFG_META_DELAY"))
+                continue;
+            if (isspace(c))
+                c = skip_space(file);
+            if (c != ',')
+                continue;
+            c = skip_space(file);
+            if (!isdigit(c))
+                continue;
+            for (num = 0; isdigit(c); c = getc(file))
+                num = 10 * num + c - '0';
+            push_number(n, word[9] == 'B' ? CFG_META_BURST : CFG_META_DELAY);
+            push_number(n, num);
+            continue;
+        }
+        prev = 0;
+        c = getc(file);
     }
+}
+
+/*
+ * One register write or delay of a .bin stream, replayed the way the driver
+ * does: page and book selects are state, bursts are register + n - 1 values
+ * padded to a pair, ASCII text is skipped.
+ */
+struct event {
+    unsigned char book, page, reg, val;
+    int delay;                                                                  // >= 0: delay record
+    int drop;
+};
 
-    fread(buffer, 1, length, file);
-    buffer[length] = '\0';
+struct events {
+    struct event *data;
+    size_t count, size;
+};
 
-    fclose(file);
-    return buffer;
+void push_event(struct events *e, struct event ev) {
+    if (e->count == e->size) {
+        e->size = e->size ? 2 * e->size : 4096;
+        e->data = realloc(e->data, e->size * sizeof(*e->data));
+        if (!e->data) {
+            perror("Unable to allocate buffer");
+            exit(EXIT_FAILURE);
+        }
+    }
+    e->data[e->count++] = ev;
 }
 
-void parse_hex_numbers(const char* buffer, unsigned char* numbers, int* count) {
-    const char *ptr = buffer;                                                   // consecutive characters
-    int num;
-    *count = 0;
+void parse_events(const unsigned char *d, size_t len, struct events *e, unsigned char *book, unsigned char *page) {
+    size_t i = 0;
+    unsigned int k, n;
 
-    while (*ptr) {
-        if (sscanf(ptr, "{ 0x%x", &num) == 1 || sscanf(ptr, ", 0x%x", &num) == 1) {
-            numbers[*count] = num;
-            (*count)++;
+    *book = 0;
+    *page = 0;
+    while (i + 1 < len) {
+        switch (d[i]) {
+        case CFG_META_DELAY:
+            push_event(e, (struct event){ .delay = d[i + 1] });
+            i += 2;
+            break;
+        case CFG_ASCII_TEXT:
+            i += d[i + 1] + 1;
+            break;
+        case CFG_META_BURST:
+            n = d[i + 1];
+            for (k = 1; (k < n) && (i + 2 + k < len); k++)
+                push_event(e, (struct event){ *book, *page, d[i + 2] + k - 1, d[i + 2 + k], -1, 0 });
+            i += 2 + ((n + 1) & ~1u);
+            break;
+        case PAGE_SEL:
+            *page = d[i + 1];
+            i += 2;
+            break;
+        default:
+            if ((d[i] == BOOK_SEL) && (*page == 0))
+                *book = d[i + 1];
+            else
+                push_event(e, (struct event){ *book, *page, d[i], d[i + 1], -1, 0 });
+            i += 2;
+            break;
         }
-        if (sscanf(ptr, "{ CFG_META_BURST, %d }", &num) == 1) {
-            numbers[*count] = CFG_META_BURST;
-            (*count)++;
-            numbers[*count] = num;
-            (*count)++;
+    }
+}
+
+/* Transactions the driver sends for a stream: selects plus merged ascending runs */
+unsigned int count_transactions(const struct events *e) {
+    unsigned int n = 0, book = 0, page = 0;
+    size_t i;
+    const struct event *ev, *prev = NULL;
+
+    for (i = 0; i < e->count; i++) {
+        ev = &e->data[i];
+        if (ev->drop)
+            continue;
+        if (ev->delay >= 0) {
+            prev = NULL;
+            continue;
+        }
+        if (prev && (ev->book == prev->book) && (ev->page == prev->page) && (ev->reg == prev->reg + 1)) {
+            prev = ev;
+            continue;
         }
-        if (sscanf(ptr, "{ CFG_META_DELAY, %d },", &num) == 1) {
-            numbers[*count] = CFG_META_DELAY;
-            (*count)++;
-            numbers[*count] = num;
-            (*count)++;
+        if (ev->book != book) {
+            n += (page != 0) + 1;                                               // page 0, book
+            book = ev->book;
+            page = 0;
         }
+        if (ev->page != page) {
+            n++;
+            page = ev->page;
+        }
+        n++;
+        prev = ev;
+    }
+    if (book != 0)
+        n += (page != 0) + 1;                                                   // back to book 0
+    return n;
+}
+
+int barrier(const struct event *ev) {
+    return (ev->delay >= 0) || (ev->book == 0) ||
+           ((ev->book == SWAP_BOOK) && (ev->page == SWAP_PAGE) && (ev->reg >= SWAP_REG) && (ev->reg < SWAP_REG + 4));
+}
+
+int cmp_write(const void *a, const void *b) {
+    const struct event *x = *(const struct event **)a, *y = *(const struct event **)b;
+    unsigned int rx = x->book << 16 | x->page << 8 | x->reg, ry = y->book << 16 | y->page << 8 | y->reg;
+
+    if (rx != ry)
+        return rx < ry ? -1 : 1;
+    return x < y ? -1 : (x > y);
+}
+
 /*
-		case CFG_ASCII_TEXT:				// skip n = s[i + 1] - 1 ascii characters
-			i +=  s[i + 1];
-			break;
-*/
-        ptr++;
+ * Between two barriers (a delay, the swap flag or a control port write) only
+ * the last value written to a DSP register matters. It is moved to the first
+ * write of that register, so the runs around it stay intact, and the later
+ * writes are dropped.
+ */
+void drop_overwritten(struct events *e) {
+    struct event **w = malloc((e->count ? e->count : 1) * sizeof(*w));
+    size_t i = 0, j, k, n;
+
+    if (!w) {
+        perror("Unable to allocate buffer");
+        exit(EXIT_FAILURE);
+    }
+    while (i < e->count) {
+        for (n = 0; (i < e->count) && !barrier(&e->data[i]); i++)
+            w[n++] = &e->data[i];
+        i++;                                                                    // the barrier
+        qsort(w, n, sizeof(*w), cmp_write);
+        for (j = 0; j < n; j = k) {
+            for (k = j + 1; (k < n) && (w[k]->book == w[j]->book) && (w[k]->page == w[j]->page) && (w[k]->reg == w[j]->reg); k++) {
+                w[j]->val = w[k]->val;
+                w[k]->drop = 1;
+            }
+        }
     }
-        printf("\n");
+    free(w);
 }
 
-int main() {
-    char *filename = FILENAME;
-    char *outputname = OUTPUT_NAME;
-    char *buffer = read_file(filename);
-    char *output[25];
-    unsigned char data, numbers[MAX_NUMBERS];
+void emit_select(struct numbers *out, unsigned char *book, unsigned char *page, const struct event *ev) {
+    if (ev->book != *book) {
+        if (*page != 0) {
+            push_number(out, PAGE_SEL);
+            push_number(out, 0);
+        }
+        push_number(out, BOOK_SEL);
+        push_number(out, ev->book);
+        *book = ev->book;
+        *page = 0;
+    }
+    if (ev->page != *page) {
+        push_number(out, PAGE_SEL);
+        push_number(out, ev->page);
+        *page = ev->page;
+    }
+}
+
+/* Runs of consecutive registers in one book/page become CFG_META_BURST records */
+void emit_bursts(const struct events *e, struct numbers *out, unsigned char end_book, unsigned char end_page) {
+    unsigned char book = 0, page = 0;
+    size_t i = 0, j, n;
+    const struct event *ev;
+
+    while (i < e->count) {
+        ev = &e->data[i];
+        if (ev->drop) {
+            i++;
+            continue;
+        }
+        if (ev->delay >= 0) {
+            push_number(out, CFG_META_DELAY);
+            push_number(out, ev->delay);
+            i++;
+            continue;
+        }
+        emit_select(out, &book, &page, ev);
+        n = 1;
+        for (j = i + 1; (j < e->count) && (n < MAX_BURST); j++) {
+            if (e->data[j].drop)
+                continue;
+            if ((e->data[j].delay >= 0) || (e->data[j].book != ev->book) ||
+                (e->data[j].page != ev->page) || (e->data[j].reg != ev->reg + n))
+                break;
+            n++;
+        }
+        if (n == 1) {
+            push_number(out, ev->reg);
+            push_number(out, ev->val);
+        } else {
+            push_number(out, CFG_META_BURST);
+            push_number(out, n + 1);
+            push_number(out, ev->reg);
+            for (; i < j; i++)
+                if (!e->data[i].drop)
+                    push_number(out, e->data[i].val);
+            if ((n + 1) & 1)
+                push_number(out, 0);                                            // pad to a pair
+        }
+        i = j;
+    }
+    if ((book != end_book) || (page != end_page)) {                               // leave it as found
+        struct event last = { .book = end_book, .page = end_page };
+        emit_select(out, &book, &page, &last);
+    }
+}
+
+/* Convert one PPC3 header into a .bin stream */
+void convert(const char *filename, struct numbers *result) {
+    struct numbers nums = { 0 }, out = { 0 };
     unsigned int count = 0, book_page_reg_burst= 0;
-    FILE* fptr;
-    fptr = fopen(OUTPUT_NAME, "wb");
-    if (fptr == NULL) {
-        printf("The file is not opened. The program will "
-               "now exit.");
-        exit(0);
+    FILE *input;
+
+    input = strcmp(filename, "-") ? fopen(filename, "r") : stdin;
+    if (!input) {
+        perror("Unable to open file");
+        exit(EXIT_FAILURE);
     }
 
-    parse_hex_numbers(buffer, numbers, &count);
+    parse_hex_numbers(input, &nums);
+    if (input != stdin)
+        fclose(input);
+    count = nums.count;
+    if (!count) {
+        printf("%s, no registers found\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    unsigned char *numbers = nums.data;
 //  printf("%s",buffer);
 //    printf("Read %d hex numbers:\n", count);
 
     numbers[0] = 0;
-    int i = 0;
+    unsigned int i = 0;
     for (i = 0; i < count; i++) {
 //    if ((numbers[i] == CFG_META_BURST) && ((book_page_reg_burst & 0x000000ff) > 0) && (i%2 == 0))
     if ((book_page_reg_burst & 0x000000ff) > 0)
         book_page_reg_burst -= 0x01;
     if ((numbers[i] == CFG_META_BURST) && ((book_page_reg_burst & 0x000000ff) == 0) && (i%2 == 0))
-        book_page_reg_burst = book_page_reg_burst & 0xffffff00 | numbers[i + 1]; 
-    if ((numbers[i] == 0x00) && (numbers[i + 1] == 0x00) &&
-       (numbers[i + 2] == 0x7f) && (numbers[i + 3] == 0x00) && (i%2 == 0))
+        book_page_reg_burst = book_page_reg_burst & 0xffffff00 | (number(&nums, i + 1) & 0xff); 
+    if ((numbers[i] == 0x00) && (number(&nums, i + 1) == 0x00) &&
+       (number(&nums, i + 2) == 0x7f) && (number(&nums, i + 3) == 0x00) && (i%2 == 0))
             book_page_reg_burst = book_page_reg_burst & 0x00ffffff | 0x00000000; // 
     #ifdef DSP_BOOK_ONLY
     if (((book_page_reg_burst & 0x00ff00ff) == 0) && (i%2 == 0) &&
-       (numbers[i+2] == 0x7f) && (numbers[i+3] == DSP_BOOK_ONLY))
+       (number(&nums, i + 2) == 0x7f) && (number(&nums, i + 3) == DSP_BOOK_ONLY))
             book_page_reg_burst = book_page_reg_burst & 0x00ffffff | DSP_BOOK_ONLY << 24; 
     #endif
     if (((book_page_reg_burst & 0x00ffffff) == 0) && (i%2 == 0) && (numbers[i] == 0x7f))
-            book_page_reg_burst = book_page_reg_burst & 0x00ffffff | numbers[i + 1]  << 24; 
+            book_page_reg_burst = book_page_reg_burst & 0x00ffffff | (number(&nums, i + 1) & 0xff) << 24; 
     #ifndef DSP_BOOK_ONLY
     if ((numbers[i] == 0x00) && ((book_page_reg_burst & 0x000000ff) == 0) && (i%2 == 0))
-            book_page_reg_burst = (book_page_reg_burst & 0xff00ffff) | (numbers[i + 1] << 16); 
+            book_page_reg_burst = (book_page_reg_burst & 0xff00ffff) | ((number(&nums, i + 1) & 0xff) << 16); 
     #endif
     if (((book_page_reg_burst & 0x000000ff) == 0) && (i%2 == 0))
             book_page_reg_burst = (book_page_reg_burst & 0xffff00ff) | (numbers[i] << 8); 
 //    printf("%X ", numbers[i]);
     #ifdef DSP_BOOK_ONLY
         if ((book_page_reg_burst & 0xff000000) == DSP_BOOK_ONLY << 24) {
-            fputc(numbers[i],fptr);
+            push_number(&out, numbers[i]);
             printf("0x%03x %x Book, Page, Reg 0x%08x Data 0x%02x\n", i, i%2, book_page_reg_burst, numbers[i]);
         }
     #endif
     #ifndef DSP_BOOK_ONLY
-        fputc(numbers[i],fptr);
+        push_number(&out, numbers[i]);
         if (i % 2) printf("0x%03x Book, Page, Reg 0x%08x Address 0x%02x Data 0x%02x\n", i / 2, book_page_reg_burst, numbers[i - 1], numbers[i]);
     #endif
     }
     #ifdef DSP_BOOK_ONLY
-    fputc(0x00,fptr);
-    fputc(0x00,fptr);
-    fputc(0x7f,fptr);
-    fputc(0x00,fptr);
+    push_number(&out, 0x00);
+    push_number(&out, 0x00);
+    push_number(&out, 0x7f);
+    push_number(&out, 0x00);
+    #endif
+    #ifdef SYNTH_BURST
+    struct events events = { 0 };
+    struct numbers bursts = { 0 };
+    unsigned char end_book, end_page;
+    unsigned int before;
+
+    parse_events(out.data, out.count, &events, &end_book, &end_page);
+    before = count_transactions(&events);
+    drop_overwritten(&events);
+    emit_bursts(&events, &bursts, end_book, end_page);
+    printf("Transactions: %u before, %u after, %zu -> %zu bytes\n",
+           before, count_transactions(&events), out.count, bursts.count);
+    free(events.data);
+    free(out.data);
+    out = bursts;
     #endif
-    fclose(fptr);
 //    printf("Counter = 0x%x:\n", book_page_reg_burst);
-        if (sscanf(filename, "%13s%", output) >= 1)
-    printf("%s, %d registers read\n",output, count);
-    printf("Output: %s\n", outputname);
+    printf("%s, %d registers read\n", filename, count);
 //    printf("\n");
 
-    free(buffer);
+    free(nums.data);
+    *result = out;
+}
+
+void write_output(const char *outputname, const struct numbers *out) {
+    FILE* fptr;
+
+    fptr = fopen(outputname, "wb");
+    if (fptr == NULL) {
+        printf("The file is not opened. The program will "
+               "now exit.");
+        exit(0);
+    }
+    if (fwrite(out->data, 1, out->count, fptr) != out->count)
+        perror(outputname);
+    fclose(fptr);
+    printf("Output: %s\n", outputname);
+}
+
+void push_le(struct numbers *n, unsigned int val, int bytes) {
+    while (bytes--) {
+        push_number(n, val & 0xff);
+        val >>= 8;
+    }
+}
+
+#define REGS			(256 * 256 * 128)
+#define REG_INDEX(ev)		(((ev)->book << 8 | (ev)->page) * 128 + (ev)->reg)
+
+/* Final value of every register a stream writes */
+void final_state(const struct events *e, unsigned char *val, unsigned char *written) {
+    size_t i;
+
+    for (i = 0; i < e->count; i++) {
+        if (e->data[i].drop || (e->data[i].delay >= 0))
+            continue;
+        val[REG_INDEX(&e->data[i])] = e->data[i].val;
+        written[REG_INDEX(&e->data[i])] = 1;
+    }
+}
+
+/*
+ * Writes that take the base state to the state of a rate: each register that
+ * ends up different is written once, with its final value, at its first write
+ * in the rate's own order. Delays are left to the base.
+ */
+void rate_delta(const struct events *rate, const unsigned char *base_val, const unsigned char *base_written,
+                int rate_hz, struct numbers *out) {
+    unsigned char *val = calloc(REGS, 1), *written = calloc(REGS, 1);
+    struct events delta = { 0 };
+    struct event ev;
+    size_t i, missing = 0;
+
+    if (!val || !written) {
+        perror("Unable to allocate buffer");
+        exit(EXIT_FAILURE);
+    }
+    final_state(rate, val, written);
+    for (i = 0; i < REGS; i++)
+        missing += base_written[i] && !written[i];
+    if (missing)
+        printf("Warning: %d Hz does not write %zu base registers, base values kept\n", rate_hz, missing);
+    for (i = 0; i < rate->count; i++) {
+        ev = rate->data[i];
+        if (ev.drop || (ev.delay >= 0) || !written[REG_INDEX(&ev)])
+            continue;
+        written[REG_INDEX(&ev)] = 0;                                            // first write only
+        ev.val = val[REG_INDEX(&ev)];
+        if (base_written[REG_INDEX(&ev)] && (base_val[REG_INDEX(&ev)] == ev.val))
+            continue;
+        push_event(&delta, ev);
+    }
+    emit_bursts(&delta, out, 0, 0);
+    printf("%d Hz: %zu registers differ from the base, %zu bytes\n", rate_hz, delta.count, out->count);
+    free(delta.data);
+    free(val);
+    free(written);
+}
+
+/*
+ * Multi-rate container, little endian:
+ *   u32 magic "TSFW", u16 version, u16 num_rates, char name[32], u32 base_len,
+ *   num_rates x { u32 rate, u32 len }, base stream, num_rates delta streams.
+ * The first rate is the base, the config of a rate is the base followed by its
+ * delta.
+ */
+void write_container(const char *outputname, const char *name, int num, char **args) {
+    struct numbers image[MAX_RATES] = { 0 }, delta[MAX_RATES] = { 0 }, out = { 0 };
+    struct events events = { 0 };
+    unsigned char *base_val = calloc(REGS, 1), *base_written = calloc(REGS, 1);
+    unsigned char book, page;
+    int rate[MAX_RATES], i;
+    char *file;
+    size_t k;
+
+    if (!base_val || !base_written) {
+        perror("Unable to allocate buffer");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num; i++) {
+        rate[i] = strtol(args[i], &file, 10);
+        if ((rate[i] <= 0) || (*file != '=')) {
+            printf("Expected <rate>=<file.h>, got %s\n", args[i]);
+            exit(EXIT_FAILURE);
+        }
+        convert(file + 1, &image[i]);
+    }
+
+    parse_events(image[0].data, image[0].count, &events, &book, &page);
+    final_state(&events, base_val, base_written);
+    for (i = 0; i < num; i++) {
+        struct events e = { 0 };
+
+        parse_events(image[i].data, image[i].count, &e, &book, &page);
+        rate_delta(&e, base_val, base_written, rate[i], &delta[i]);
+        free(e.data);
+    }
+
+    push_le(&out, CONTAINER_MAGIC, 4);
+    push_le(&out, CONTAINER_VERSION, 2);
+    push_le(&out, num, 2);
+    for (k = 0; k < 32; k++)
+        push_number(&out, k < strlen(name) && k < 31 ? name[k] : 0);
+    push_le(&out, image[0].count, 4);
+    for (i = 0; i < num; i++) {
+        push_le(&out, rate[i], 4);
+        push_le(&out, delta[i].count, 4);
+    }
+    for (k = 0; k < image[0].count; k++)
+        push_number(&out, image[0].data[k]);
+    for (i = 0; i < num; i++)
+        for (k = 0; k < delta[i].count; k++)
+            push_number(&out, delta[i].data[k]);
+    write_output(outputname, &out);
+    printf("Container %s: %d rates, %zu bytes\n", name, num, out.count);
+
+    for (i = 0; i < num; i++) {
+        free(image[i].data);
+        free(delta[i].data);
+    }
+    free(events.data);
+    free(out.data);
+    free(base_val);
+    free(base_written);
+}
+
+/*
+ * hex [input.h|-] [output.bin]
+ * hex -c name output.bin rate=input.h [rate=input.h]...
+ */
+int main(int argc, char **argv) {
+    struct numbers out;
+
+    if ((argc > 1) && !strcmp(argv[1], "-c")) {
+        if ((argc < 5) || (argc - 4 > MAX_RATES)) {
+            printf("Usage: %s -c name output.bin rate=input.h [rate=input.h]... (up to %d rates)\n",
+                   argv[0], MAX_RATES);
+            exit(EXIT_FAILURE);
+        }
+        write_container(argv[3], argv[2], argc - 4, &argv[4]);
+        return 0;
+    }
+    convert(argc > 1 ? argv[1] : FILENAME, &out);
+    write_output(argc > 2 ? argv[2] : OUTPUT_NAME, &out);
+    free(out.data);
     return 0;
 }
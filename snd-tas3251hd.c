@@ -15,8 +15,6 @@
  * General Public License for more details.
  */
 
-#define DEBUG
-
 //#include <stdio.h>
 #include <linux/module.h>
 #include <linux/platform_device.h>
@@ -27,6 +25,7 @@
 #include <linux/delay.h>
 #include <linux/gpio.h>
 #include <linux/gpio/consumer.h>
+#include <linux/pm_runtime.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
 #include <sound/pcm_params.h>
@@ -36,15 +35,23 @@
 #include <linux/clk.h>
 #include <linux/firmware.h>
 
+#include "tas3251hd-clk.h"
+
+#define CREATE_TRACE_POINTS
+#include "snd_tas3251hd_trace.h"
+
 #define TAS3251_PAGE		0x00
-#define TAS3251_DIG_VOL_LEFT	0x3d
-#define TAS3251_DIG_VOL_RIGHT	0x3e
-#define TAS3251_POWER		0x02
 #define TAS3251_BOOK		0x7f
+#define TAS3251_VIRT_BASE	0x100						// see tas3251.c
+#define TAS3251_DIG_VOL_LEFT	(TAS3251_VIRT_BASE + 0x3d)
+#define TAS3251_DIG_VOL_RIGHT	(TAS3251_VIRT_BASE + 0x3e)
+#define TAS3251_POWER		(TAS3251_VIRT_BASE + 0x02)
 
 #define TAS3251_DSPR		0x80
 
 #define DEFAULT_RATE		44100
+#define MCLK_44K1		45158400						// SI5351 output per
+#define MCLK_48K		49152000						// rate family
 
 #define ALSA_NAME		"tas3251.1-004a"
 #define ALSA_DAI_NAME		"tas3251-hifi"
@@ -65,8 +72,9 @@ struct brd_drv_data {
 
 static struct brd_drv_data drvdata;
 static struct gpio_desc *reset_gpio;
+/* What the SI5351 and codec can clock, the codec narrows it to its firmware */
 static const unsigned int hb_dacplushd_rates[] = {
-	96000, 48000, 88200, 44100,
+	192000, 176400, 96000, 48000, 88200, 44100, 32000,
 };
 
 static struct snd_pcm_hw_constraint_list hb_dacplushd_constraints = {
@@ -195,7 +203,47 @@ static SOC_ENUM_SINGLE_DECL(tas3251hd_enum,
 		0, 0, tas3251hd_dsp_low_pass_texts);
 
 */
+static int snd_tas3251hd_trim_info(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = -CLK_HIFIBERRY_DACHD_TRIM_MAX;
+	uinfo->value.integer.max = CLK_HIFIBERRY_DACHD_TRIM_MAX;
+	return 0;
+}
+
+static int snd_tas3251hd_trim_get(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	ucontrol->value.integer.value[0] = IS_ERR(drvdata.sclk) ? 0 :
+		clk_hifiberry_dachd_get_trim(drvdata.sclk);
+	return 0;
+}
+
+/* MCLK offset in ppb, e.g. to follow the clock of a network stream */
+static int snd_tas3251hd_trim_put(struct snd_kcontrol *kcontrol,
+		struct snd_ctl_elem_value *ucontrol)
+{
+	long ppb = ucontrol->value.integer.value[0];
+	int ret;
+
+	if (IS_ERR(drvdata.sclk))
+		return -ENODEV;
+	if (ppb == clk_hifiberry_dachd_get_trim(drvdata.sclk))
+		return 0;
+	ret = clk_hifiberry_dachd_set_trim(drvdata.sclk, ppb);
+	return ret ? ret : 1;
+}
+
 static const struct snd_kcontrol_new tas3251hd_controls[] = {
+	{
+		.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name = "MCLK Trim",
+		.info = snd_tas3251hd_trim_info,
+		.get = snd_tas3251hd_trim_get,
+		.put = snd_tas3251hd_trim_put,
+	},
 //	SOC_ENUM_EXT("Lowpass Route",
 //		tas3251hd_enum,
 //		snd_tas3251hd_lowpass_get,
@@ -216,8 +264,15 @@ static int snd_tas3251hd_dacplushd_init(struct snd_soc_pcm_runtime *rtd)
 	if (ret < 0)
 		dev_warn(card->dev, "Failed to set volume limit: %d\n", ret);
 
+	ret = pm_runtime_resume_and_get(component->dev);						// codec awake for
+	if (ret < 0) {											// the writes
+		dev_err(card->dev, "Failed to resume codec: %d\n", ret);
+		return ret;
+	}
 	snd_soc_component_write(component, TAS3251_DIG_VOL_LEFT, 0x70);					// initial volume L
 	snd_soc_component_write(component, TAS3251_DIG_VOL_RIGHT, 0x70);				// initial volume R
+	pm_runtime_mark_last_busy(component->dev);
+	pm_runtime_put_autosuspend(component->dev);
 	dai->name = "TAS3251 HD";
 	dai->stream_name = "TAS3251 HD HiFi";
 	dai->dai_fmt = SND_SOC_DAIFMT_I2S | SND_SOC_DAIFMT_NB_NF
@@ -225,6 +280,7 @@ static int snd_tas3251hd_dacplushd_init(struct snd_soc_pcm_runtime *rtd)
 
 	/* allow only fixed 32 clock counts per channel */
 	snd_soc_dai_set_bclk_ratio(cpu_dai, 32*2);
+	snd_soc_dai_set_bclk_ratio(asoc_rtd_to_codec(rtd, 0), 32*2);
 /*//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 	if (device_property_read_string(card->dev, "firmwares", &fw_names))
 		fw_names = "default";
@@ -293,9 +349,17 @@ static int snd_tas3251hd_dacplushd_hw_params(
 	struct snd_pcm_substream *substream, struct snd_pcm_hw_params *params)
 {
 	int ret = 0;
+	unsigned long mclk;
 	struct snd_soc_pcm_runtime *rtd = substream->private_data;
 	struct snd_soc_component *component = asoc_rtd_to_codec(rtd, 0)->component;
+
+	trace_snd_tas3251hd_dacplushd_hw_params_start(params_rate(params),
+		params_channels(params), params_width(params), 0);
 	snd_tas3251hd_dacplushd_set_sclk(component, params_rate(params));
+	mclk = IS_ERR(drvdata.sclk) ? 0 : clk_hifiberry_dachd_get_mclk(drvdata.sclk);
+	if (!mclk)
+		mclk = (params_rate(params) % 8000) ? MCLK_44K1 : MCLK_48K;
+	ret = snd_soc_dai_set_sysclk(asoc_rtd_to_codec(rtd, 0), 0, mclk, SND_SOC_CLOCK_IN);
 	dev_dbg(component->dev, "Sample rate = %d", params_rate(params));		///////////////////////////////////////////////////
 
 //	snd_soc_component_update_bits(component, TAS3251_POWER, 0x80, 0x80);
@@ -306,6 +370,8 @@ static int snd_tas3251hd_dacplushd_hw_params(
 //	snd_tas3251hd_dacplushd_write_firmware(component);						// testing
 //	snd_soc_component_update_bits(component, TAS3251_POWER, 0x80, 0x00);
 
+	trace_snd_tas3251hd_dacplushd_hw_params_end(params_rate(params),
+		params_channels(params), params_width(params), ret);
 	return ret;
 }
 
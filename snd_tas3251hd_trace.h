@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * ASoC Driver for HiFiBerry DAC+ HD tracepoints
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM snd_tas3251hd
+
+#if !defined(_SND_TAS3251HD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SND_TAS3251HD_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(snd_tas3251hd_hw_params,
+	TP_PROTO(unsigned int rate, unsigned int channels, unsigned int width, int ret),
+	TP_ARGS(rate, channels, width, ret),
+	TP_STRUCT__entry(
+		__field(unsigned int, rate)
+		__field(unsigned int, channels)
+		__field(unsigned int, width)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->rate = rate;
+		__entry->channels = channels;
+		__entry->width = width;
+		__entry->ret = ret;
+	),
+	TP_printk("rate=%u channels=%u width=%u ret=%d", __entry->rate,
+		  __entry->channels, __entry->width, __entry->ret)
+);
+
+DEFINE_EVENT(snd_tas3251hd_hw_params, snd_tas3251hd_dacplushd_hw_params_start,
+	TP_PROTO(unsigned int rate, unsigned int channels, unsigned int width, int ret),
+	TP_ARGS(rate, channels, width, ret));
+
+DEFINE_EVENT(snd_tas3251hd_hw_params, snd_tas3251hd_dacplushd_hw_params_end,
+	TP_PROTO(unsigned int rate, unsigned int channels, unsigned int width, int ret),
+	TP_ARGS(rate, channels, width, ret));
+
+#endif /* _SND_TAS3251HD_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE snd_tas3251hd_trace
+
+#include <trace/define_trace.h>
@@ -8,8 +8,6 @@
  *     Michael Trimarchi <michael@amarulasolutions.com>
  */
 
-#define DEBUG
-
 #include <linux/module.h>
 #include <linux/slab.h>
 #include <linux/kernel.h>
@@ -24,33 +22,86 @@
 #include <sound/tlv.h>
 #include <linux/of.h>
 #include <linux/i2c.h>
+#include <linux/regmap.h>
 #include <linux/firmware.h>
+#include <linux/sort.h>
+#include <linux/bsearch.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/log2.h>
+#include <linux/pm_runtime.h>
+#include <linux/bitmap.h>
+#include <asm/unaligned.h>
+
+#include "tas3251.h"
+
+#define CREATE_TRACE_POINTS
+#include "tas3251_trace.h"
 
 #define DEFAULT_RATE			44100
+#define TAS3251_FW_TIMEOUT_MS		5000
+#define TAS3251_AUTOSUSPEND_MS		3000
+#define TAS3251_VOL_DELAY_MS		20	// volume changes collected per write
+#define TAS3251_MAX_METERS		8	// 32 bit DSP words
+#define TAS3251_COEFF_MAX		4096	// bytes per coefficient upload, after the TLV header
+#define TAS3251_COEFF_SWAP		0x01	// upload flag: swap buffers when done
+#define TAS3251_METER_IDLE_MS		1000	// meters stop when unread this long
+#define TAS3251_DELTA_GAP		4	// unchanged bytes kept inside a bulk
+
+/*
+ * Registers live in 128 byte pages, 256 pages per book. Register 0x00 of
+ * every page selects the page, register 0x7f of page 0 selects the book.
+ * The regmap addresses them virtually as (book, page, reg) above
+ * TAS3251_VIRT_BASE; only the two selectors are accessed physically.
+ */
+#define TAS3251_PAGE_SEL		0x00
+#define TAS3251_BOOK_SEL		0x7f
+#define TAS3251_PAGE_LEN		0x80
+#define TAS3251_VIRT_BASE		0x100
+#define TAS3251_REG(book, page, reg)	(TAS3251_VIRT_BASE + \
+					((((book) << 8) | (page)) * TAS3251_PAGE_LEN) + (reg))
+#define TAS3251_REG_BOOK(vreg)		((((vreg) - TAS3251_VIRT_BASE) / TAS3251_PAGE_LEN) >> 8)
+#define TAS3251_MAX_REGISTER		TAS3251_REG(0xff, 0xff, 0x7f)
+#define TAS3251_NUM_BOOKS		256
+
+#define TAS3251_BOOK_CTRL		0x00
+#define TAS3251_BOOK_DSP		0x8c
+
+#define TAS3251_RESET			TAS3251_REG(0, 0, 0x01)
+#define TAS3251_POWER			TAS3251_REG(0, 0, 0x02)
+#define TAS3251_MUTE			TAS3251_REG(0, 0, 0x03)
+#define TAS3251_PLL_EN			TAS3251_REG(0, 0, 0x04)
+#define TAS3251_SCLK_LRCLK_CFG		TAS3251_REG(0, 0, 0x09)
+#define TAS3251_MASTER_MODE		TAS3251_REG(0, 0, 0x0c)
+#define TAS3251_PLL_DSP_REF		TAS3251_REG(0, 0, 0x0d)
+#define TAS3251_MASTER_CLKDIV_1		TAS3251_REG(0, 0, 0x20)
+#define TAS3251_MASTER_CLKDIV_2		TAS3251_REG(0, 0, 0x21)
+#define TAS3251_ERROR_DETECT		TAS3251_REG(0, 0, 0x25)
+#define TAS3251_I2S_1			TAS3251_REG(0, 0, 0x28)
+#define TAS3251_I2S_2			TAS3251_REG(0, 0, 0x29)
+#define TAS3251_DIG_VOL_LEFT		TAS3251_REG(0, 0, 0x3d)
+#define TAS3251_DIG_VOL_RIGHT		TAS3251_REG(0, 0, 0x3e)
+#define TAS3251_DIG_MUTE_1		TAS3251_REG(0, 0, 0x3f)
+#define TAS3251_RATE_DET_1		TAS3251_REG(0, 0, 0x5b)
+#define TAS3251_CLOCK_STATUS		TAS3251_REG(0, 0, 0x5f)
+#define TAS3251_ANALOG_MUTE_DET		TAS3251_REG(0, 0, 0x6c)
+#define TAS3251_GPIN			TAS3251_REG(0, 0, 0x77)
+#define TAS3251_DIGITAL_MUTE_DET	TAS3251_REG(0, 0, 0x78)
+#define TAS3251_DSP_SWAP_FLAG		TAS3251_REG(TAS3251_BOOK_DSP, 0x23, 0x14)
 
-#define TAS3251_RESET			0x01
-#define TAS3251_POWER			0x02
-#define TAS3251_MUTE			0x03
-#define TAS3251_PLL_EN			0x04
-#define TAS3251_SCLK_LRCLK_CFG		0x09
-#define TAS3251_MASTER_MODE		0x0c
-#define TAS3251_PLL_DSP_REF		0x0d
-#define TAS3251_MASTER_CLKDIV_1		0x20
-#define TAS3251_MASTER_CLKDIV_2		0x21
-#define TAS3251_ERROR_DETECT		0x25
-#define TAS3251_I2S_1			0x28
-#define TAS3251_I2S_2			0x29
-#define TAS3251_DIG_VOL_LEFT		0x3d
-#define TAS3251_DIG_VOL_RIGHT		0x3e
-#define TAS3251_DIG_MUTE_1		0x3f
-#define TAS3251_CLOCK_STATUS		0x5f
-
-#define TAS3251_SAMPLERATES		{44100, 48000, 88200, 96000}			
+#define TAS3251_SAMPLERATES		{44100, 48000, 88200, 96000, 32000, 176400, 192000}
 #define TAS3251_FORMATS			(SNDRV_PCM_FMTBIT_S32_LE | SNDRV_PCM_FMTBIT_S24_LE |\
 					SNDRV_PCM_FMTBIT_S24_3LE | SNDRV_PCM_FMTBIT_S20_3LE |\
 					SNDRV_PCM_FMTBIT_S16_LE)
-#define TAS3251_RATES			(SNDRV_PCM_RATE_44100 | SNDRV_PCM_RATE_48000 |\
-					SNDRV_PCM_RATE_88200 | SNDRV_PCM_RATE_96000)
+#define TAS3251_RATES			(SNDRV_PCM_RATE_32000 | SNDRV_PCM_RATE_44100 |\
+					SNDRV_PCM_RATE_48000 | SNDRV_PCM_RATE_88200 |\
+					SNDRV_PCM_RATE_96000 | SNDRV_PCM_RATE_176400 |\
+					SNDRV_PCM_RATE_192000)
+#define TAS3251_MCLK_44K1		45158400					// MCLK of the rate families
+#define TAS3251_MCLK_48K		49152000					// in producer mode
+#define TAS3251_BCLK_RATIO		64
 
 #define TAS3251_RSTM			0x10
 #define TAS3251_RSTR			0x01
@@ -71,115 +122,1116 @@
 #define TAS3251_AFMT			0x30
 #define TAS3251_ALEN			0x03
 #define TAS3251_CDST6_ERR		0x40
+#define TAS3251_SWAP			0x01
+#define TAS3251_VOL_FREQ_MASK		0xcc	// VNDF, VNUF
+#define TAS3251_VOL_RAMP		0x88	// step every 4 samples
+#define TAS3251_VOL_IMMEDIATE		0xcc
+#define TAS3251_SWAP_TIMEOUT_US		100000
 
 /* PPC3 commands */
 #define CFG_META_DELAY			0xfe
 #define CFG_META_BURST			0xfd
 #define CFG_ASCII_TEXT			0xf0
 
+/*
+ * Control port state after the register reset at probe: DSP in reset, PLL
+ * on, 0 dB. These are read from the cache without a bus access.
+ */
 static const struct reg_default tas3251_reg_defaults[] = {
-	{ TAS3251_RESET, 0x00 },		{ TAS3251_POWER, 0x80 },
-	{ TAS3251_MUTE, 0x00 },			{ TAS3251_PLL_EN, 0x01 },
-	{ TAS3251_MASTER_CLKDIV_1, 0x00 },	{ TAS3251_MASTER_CLKDIV_2, 0x00 },
-	{ TAS3251_DIG_VOL_LEFT, 0x30 },		{ TAS3251_DIG_VOL_RIGHT, 0x30 },
+	{ TAS3251_POWER, 0x80 },		{ TAS3251_MUTE, 0x00 },
+	{ TAS3251_PLL_EN, 0x01 },		{ TAS3251_MASTER_CLKDIV_1, 0x00 },
+	{ TAS3251_MASTER_CLKDIV_2, 0x00 },	{ TAS3251_DIG_VOL_LEFT, 0x30 },
+	{ TAS3251_DIG_VOL_RIGHT, 0x30 },
 };
 
-int samplerates[4] = TAS3251_SAMPLERATES;
+int samplerates[] = TAS3251_SAMPLERATES;					// without a container
+
+#define TAS3251_MAX_RATES		8
+#define TAS3251_FW_MAGIC		0x57465354				// "TSFW"
+#define TAS3251_FW_VERSION		1
+
+static unsigned int fw_cache_kb;
+module_param(fw_cache_kb, uint, 0644);
+MODULE_PARM_DESC(fw_cache_kb, "Memory for compiled DSP configs in KiB, the active one is always kept (0 = no limit)");
+
+static unsigned int meter_interval_ms = 100;
+module_param(meter_interval_ms, uint, 0644);
+MODULE_PARM_DESC(meter_interval_ms, "DSP level meter refresh interval in ms");
+
+/*
+ * Multi-rate container made by hex.c: this header, num_rates rate entries,
+ * the base stream and one delta stream per rate. The config of a rate is the
+ * base followed by its delta.
+ */
+struct tas3251_fw_hdr {
+	__le32 magic;
+	__le16 version;
+	__le16 num_rates;
+	char name[32];
+	__le32 base_len;
+} __packed;
+
+struct tas3251_fw_rate {
+	__le32 rate;
+	__le32 len;
+} __packed;
+
+enum tas3251_fw_op_type {
+	TAS3251_FW_WRITE,				// single register
+	TAS3251_FW_BULK,				// consecutive registers, one transfer
+	TAS3251_FW_DELAY,				// sleep val ms
+};
+
+/* One step of a compiled PPC3 config, registers are virtual */
+struct tas3251_fw_op {
+	u8 type;
+	u16 len;					// registers in a bulk segment
+	unsigned int reg;
+	unsigned int val;				// value, bulk offset into vals or delay
+};
+
+struct tas3251_fw_cfg {
+	struct tas3251_fw_op *ops;
+	unsigned int num_ops;
+	u8 *vals;
+	unsigned int num_vals;
+	bool valid;					// loaded, may hold no ops
+};
+
+#define TAS3251_HIST_BINS	24			// log2 us, last bin collects >= 4 s
+
+/* Cheap enough to keep on: plain counters, updated where the work is done. */
+struct tas3251_stats {
+	u64 downloads;
+	u64 skipped;					// rate unchanged
+	u64 bytes;
+	u64 xfers;
+	u64 delay_ms;
+	u64 loads;					// configs compiled
+	u64 evictions;
+	u32 download_us[TAS3251_HIST_BINS];
+	u32 mute_us[TAS3251_HIST_BINS];
+	u32 hw_params_us[TAS3251_HIST_BINS];
+	u64 resumes;
+	u64 restores;					// full restores after power loss
+	u32 resume_us[TAS3251_HIST_BINS];		// resume to first sample
+};
 
 struct tas3251_private {
 	struct regmap *regmap;
 	unsigned int format, rate;
 //	struct gpio_desc *gpio_mute_n, *gpio_pdn_n;
 	struct mutex lock;
-	uint8_t *dsp_cfg_data[4];
-	int dsp_cfg_len[4];
+	struct tas3251_fw_cfg dsp_base;			// shared part of a container
+	struct tas3251_fw_cfg dsp_cfg[TAS3251_MAX_RATES];
+	struct tas3251_fw_cfg dsp_delta[TAS3251_MAX_RATES][TAS3251_MAX_RATES];	// [from][to]
+	int samplerates[TAS3251_MAX_RATES];
+	unsigned int num_rates;
+	unsigned int fw_rates[TAS3251_MAX_RATES];	// rates with firmware
+	struct snd_pcm_hw_constraint_list rate_constraint;
+	int active_cfg;					// config the DSP holds, or -1
+	bool fw_container;				// rates are parts of one file
+	size_t fw_size;					// container size, to spot a new file
+	bool fw_present[TAS3251_MAX_RATES];		// image on disk, fetched on demand
+	size_t fw_off[TAS3251_MAX_RATES];		// rate part in the container
+	size_t fw_len[TAS3251_MAX_RATES];
+	unsigned long fw_used[TAS3251_MAX_RATES];	// LRU ticks
+	unsigned long fw_tick;
+	u32 fw_cached;					// names in the firmware cache, bit 0 the
+							// container, bit cfg + 1 a rate file
 	const char *fw_name;
+	struct snd_soc_component *component;
+	struct completion fw_done;
+	struct workqueue_struct *fw_wq;			// ordered: fetch, then downloads
+	struct work_struct fetch_work;
+	struct work_struct fw_work;
+	struct mutex vol_lock;
+	u8 vol[2];					// register values, left and right
+	bool vol_pending;				// vol not written yet
+	struct delayed_work vol_work;
+	unsigned int meter_reg;				// first meter word, virtual
+	unsigned int meter_words;			// 0 without meters
+	spinlock_t meter_lock;
+	u32 meter[TAS3251_MAX_METERS];
+	unsigned long meter_read;			// jiffies of the last control read
+	bool meter_running;
+	struct delayed_work meter_work;
 	int previous_rate;
+	unsigned int sysclk;				// MCLK, 0 picks it by rate family
+	unsigned int bclk_ratio;			// BCLK per frame in producer mode
+	unsigned int book;
+	DECLARE_BITMAP(dsp_books, TAS3251_NUM_BOOKS);	// books in the register cache
+	bool dsp_programmed;
+	bool state_lost;				// power may have been removed
+	ktime_t resume_start;
+	struct tas3251_stats stats;
 };
 
-static void tas3251_get_firmware(struct snd_soc_component *component) {
-	int i, ret;
+static void tas3251_hist_add(u32 *hist, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+
+	hist[us > 0 ? min_t(int, ilog2(us) + 1, TAS3251_HIST_BINS - 1) : 0]++;
+}
+
+/*
+ * Book 0 is the resting book: the controls and all book 0 defines above rely
+ * on it. Anything touching a DSP book selects it here with priv->lock held and
+ * goes back to book 0 before dropping the lock; book 0 accesses hold the lock
+ * as well, so they never land in a DSP book. The page selector is cached,
+ * so a book select that is already in place costs no I2C traffic.
+ */
+static int tas3251_select_book(struct tas3251_private *priv, unsigned int book)
+{
+	int ret;
+
+	if (priv->book == book)
+		return 0;
+	ret = regmap_update_bits(priv->regmap, TAS3251_PAGE_SEL, 0xff, 0x00);
+	if (!ret)
+		ret = regmap_write(priv->regmap, TAS3251_BOOK_SEL, book);
+	if (!ret)
+		priv->book = book;
+	if (!ret && (book != TAS3251_BOOK_CTRL))
+		set_bit(book, priv->dsp_books);
+	return ret;
+}
+
+static bool tas3251_volatile_reg(struct device *dev, unsigned int reg);
+
+/*
+ * Once a config has been written the cache holds every register it touches,
+ * so later replays only put the registers that differ on the wire.
+ */
+static int tas3251_write_cfg(struct tas3251_private *priv, unsigned int reg,
+			     unsigned int val)
+{
+	if (!priv->dsp_programmed ||
+	    tas3251_volatile_reg(regmap_get_device(priv->regmap), reg))
+		return regmap_write(priv->regmap, reg, val);
+	return regmap_update_bits(priv->regmap, reg, 0xff, val);
+}
+
+/* Copy a scratch op list into a right-sized config */
+static int tas3251_store_cfg(struct tas3251_fw_cfg *cfg,
+			     const struct tas3251_fw_op *ops, unsigned int n,
+			     const u8 *vals, unsigned int nvals)
+{
+	cfg->ops = kvmalloc_array(n ? n : 1, sizeof(*ops), GFP_KERNEL);
+	cfg->vals = kvmalloc(nvals ? nvals : 1, GFP_KERNEL);
+	if (!cfg->ops || !cfg->vals) {
+		kvfree(cfg->ops);
+		kvfree(cfg->vals);
+		cfg->ops = NULL;
+		cfg->vals = NULL;
+		return -ENOMEM;
+	}
+	memcpy(cfg->ops, ops, n * sizeof(*ops));
+	memcpy(cfg->vals, vals, nvals);
+	cfg->num_ops = n;
+	cfg->num_vals = nvals;
+	cfg->valid = true;
+	return 0;
+}
+
+/* PPC3 streams set the swap flag themselves, the driver swaps after a delta */
+static bool tas3251_swap_reg(unsigned int reg)
+{
+	return (reg >= TAS3251_DSP_SWAP_FLAG) && (reg <= TAS3251_DSP_SWAP_FLAG + 3);
+}
+
+/* Registers of a segment at reg up to the swap flag boundary, the flag is an op of its own */
+static unsigned int tas3251_swap_split(unsigned int reg, unsigned int len)
+{
+	if ((reg < TAS3251_DSP_SWAP_FLAG) && (reg + len > TAS3251_DSP_SWAP_FLAG))
+		return TAS3251_DSP_SWAP_FLAG - reg;
+	if (tas3251_swap_reg(reg) && (reg + len > TAS3251_DSP_SWAP_FLAG + 4))
+		return TAS3251_DSP_SWAP_FLAG + 4 - reg;
+	return len;
+}
+
+/*
+ * Compile a PPC3 byte stream into an op list. Page and book selects become
+ * part of the virtual register address, runs of plain writes to ascending
+ * registers are merged into bulk segments capped at the adapter's maximum
+ * write, and every length is checked, so a malformed file is rejected here
+ * instead of halfway through a download. Segments never straddle the swap
+ * flag, so tas3251_swap_op() finds the stream's swap in any layout.
+ *
+ * Stream layout: {reg, val} pairs, {CFG_META_DELAY, ms},
+ * {CFG_META_BURST, n} followed by n bytes (reg, n - 1 values) padded to a
+ * pair, {CFG_ASCII_TEXT, n} followed by n - 1 characters.
+ */
+static int tas3251_compile_firmware(struct tas3251_private *priv,
+				    const u8 *data, unsigned int len,
+				    struct tas3251_fw_cfg *cfg)
+{
+	struct device *dev = priv->component->dev;
+	unsigned int max = regmap_get_raw_write_max(priv->regmap);
+	unsigned int i = 0, j, n = 0, nvals = 0, book = TAS3251_BOOK_CTRL, page = 0;
+	unsigned int reg, last, count, k, stride;
+	struct tas3251_fw_op *ops = NULL, *op;
+	const u8 *src;
+	u8 *vals = NULL;
+	int ret = -ENOMEM;
+
+	ops = kvmalloc_array(len, sizeof(*ops), GFP_KERNEL);			// worst case, every
+	vals = kvmalloc(len, GFP_KERNEL);					// op eats a byte
+	if (!ops || !vals)
+		goto err;
+
+	ret = -EINVAL;
+	while (i < len) {
+		if (i + 2 > len)
+			goto err;
+		reg = data[i];
+		last = (page == 0) ? TAS3251_BOOK_SEL - 1 : TAS3251_PAGE_LEN - 1;
+		switch (reg) {
+		case CFG_META_DELAY:
+			ops[n++] = (struct tas3251_fw_op){
+				.type = TAS3251_FW_DELAY, .val = data[i + 1] };
+			i += 2;
+			continue;
+		case CFG_ASCII_TEXT:
+			if (!data[i + 1] || (i + data[i + 1] + 1 > len))
+				goto err;
+			i += data[i + 1] + 1;
+			continue;
+		case TAS3251_PAGE_SEL:
+			page = data[i + 1];
+			i += 2;
+			continue;
+		case CFG_META_BURST:
+			if ((data[i + 1] < 2) || (i + 2 + data[i + 1] > len))
+				goto err;
+			count = data[i + 1] - 1;
+			reg = data[i + 2];
+			if ((reg == TAS3251_PAGE_SEL) || (reg + count - 1 > last))	// bursts stay
+				goto err;						// in their page
+			src = &data[i + 3];
+			stride = 1;
+			i += 2 + round_up(data[i + 1], 2);
+			break;
+		default:
+			if ((reg == TAS3251_BOOK_SEL) && (page == 0)) {
+				book = data[i + 1];
+				i += 2;
+				continue;
+			}
+			if (reg > last)
+				goto err;
+			src = &data[i + 1];
+			stride = 2;
+			for (count = 1; (i + 2 * count + 1 < len) && (reg + count <= last); count++)
+				if (data[i + 2 * count] != reg + count)
+					break;
+			i += 2 * count;
+			break;
+		}
+
+		while (count) {
+			k = max ? min(count, max) : count;
+			k = tas3251_swap_split(TAS3251_REG(book, page, reg), k);
+			op = &ops[n++];
+			op->reg = TAS3251_REG(book, page, reg);
+			op->len = k;
+			if (k == 1) {
+				op->type = TAS3251_FW_WRITE;
+				op->val = *src;
+			} else {
+				op->type = TAS3251_FW_BULK;
+				op->val = nvals;
+				for (j = 0; j < k; j++)
+					vals[nvals++] = src[j * stride];
+			}
+			src += k * stride;
+			reg += k;
+			count -= k;
+		}
+	}
+
+	ret = tas3251_store_cfg(cfg, ops, n, vals, nvals);
+	if (ret)
+		goto err;
+	kvfree(ops);
+	kvfree(vals);
+	dev_dbg(dev, "%u ops, %u bulk bytes", n, nvals);
+	return 0;
+
+err:
+	if (ret == -EINVAL)
+		dev_err(dev, "firmware is malformed at offset %u\n", i);
+	kvfree(ops);
+	kvfree(vals);
+	return ret;
+}
+
+static void tas3251_free_cfg(struct tas3251_fw_cfg *cfg)
+{
+	kvfree(cfg->ops);
+	kvfree(cfg->vals);
+	cfg->ops = NULL;
+	cfg->vals = NULL;
+	cfg->num_ops = 0;
+	cfg->num_vals = 0;
+	cfg->valid = false;
+}
+
+/* The full config of a container rate: base ops, then the rate's ops */
+static int tas3251_cat_cfg(const struct tas3251_fw_cfg *base,
+			   const struct tas3251_fw_cfg *rate,
+			   struct tas3251_fw_cfg *cfg)
+{
+	unsigned int i, n = base->num_ops + rate->num_ops;
+	unsigned int nvals = base->num_vals + rate->num_vals;
+
+	cfg->ops = kvmalloc_array(n ? n : 1, sizeof(*cfg->ops), GFP_KERNEL);
+	cfg->vals = kvmalloc(nvals ? nvals : 1, GFP_KERNEL);
+	if (!cfg->ops || !cfg->vals) {
+		tas3251_free_cfg(cfg);
+		return -ENOMEM;
+	}
+	cfg->num_ops = n;
+	cfg->num_vals = nvals;
+	cfg->valid = true;
+	memcpy(cfg->ops, base->ops, base->num_ops * sizeof(*base->ops));
+	memcpy(cfg->vals, base->vals, base->num_vals);
+	memcpy(&cfg->ops[base->num_ops], rate->ops, rate->num_ops * sizeof(*rate->ops));
+	memcpy(&cfg->vals[base->num_vals], rate->vals, rate->num_vals);
+	for (i = base->num_ops; i < cfg->num_ops; i++)
+		if (cfg->ops[i].type == TAS3251_FW_BULK)
+			cfg->ops[i].val += base->num_vals;
+	return 0;
+}
+
+struct tas3251_reg_val {
+	unsigned int reg;
+	unsigned int seq;
+	u8 val;
+};
+
+static int tas3251_reg_val_cmp(const void *a, const void *b)
+{
+	const struct tas3251_reg_val *x = a, *y = b;
+
+	if (x->reg != y->reg)
+		return x->reg < y->reg ? -1 : 1;
+	return x->seq < y->seq ? -1 : (x->seq > y->seq);
+}
+
+static int tas3251_reg_cmp(const void *key, const void *elt)
+{
+	unsigned int reg = *(const unsigned int *)key;
+	const struct tas3251_reg_val *rv = elt;
+
+	return reg < rv->reg ? -1 : (reg > rv->reg);
+}
+
+/*
+ * Only DSP books are compared: control port registers are also moved by
+ * mute, volume and format changes, so a delta always writes them.
+ */
+static bool tas3251_delta_reg(struct tas3251_private *priv, unsigned int reg)
+{
+	return (TAS3251_REG_BOOK(reg) != TAS3251_BOOK_CTRL) &&
+	       !tas3251_volatile_reg(regmap_get_device(priv->regmap), reg);
+}
+
+static u8 tas3251_op_val(const struct tas3251_fw_cfg *cfg,
+			 const struct tas3251_fw_op *op, unsigned int i)
+{
+	return (op->type == TAS3251_FW_BULK) ? cfg->vals[op->val + i] : op->val;
+}
+
+/* Final DSP register state after running cfg, sorted by register */
+static struct tas3251_reg_val *tas3251_cfg_state(struct tas3251_private *priv,
+						 const struct tas3251_fw_cfg *cfg,
+						 unsigned int *num)
+{
+	const struct tas3251_fw_op *op, *end = cfg->ops + cfg->num_ops;
+	struct tas3251_reg_val *state;
+	unsigned int n = 0, i, j;
+
+	for (op = cfg->ops; op < end; op++)
+		if ((op->type != TAS3251_FW_DELAY) && tas3251_delta_reg(priv, op->reg))
+			n += op->len;
+	state = kvmalloc_array(n ? n : 1, sizeof(*state), GFP_KERNEL);
+	if (!state)
+		return NULL;
+
+	n = 0;
+	for (op = cfg->ops; op < end; op++) {
+		if ((op->type == TAS3251_FW_DELAY) || !tas3251_delta_reg(priv, op->reg))
+			continue;
+		for (i = 0; i < op->len; i++, n++) {
+			state[n].reg = op->reg + i;
+			state[n].seq = n;
+			state[n].val = tas3251_op_val(cfg, op, i);
+		}
+	}
+	sort(state, n, sizeof(*state), tas3251_reg_val_cmp, NULL);
+	for (i = 0, j = 0; i < n; i++) {					// last write wins
+		if (j && (state[j - 1].reg == state[i].reg))
+			j--;
+		state[j++] = state[i];
+	}
+	*num = j;
+	return state;
+}
+
+/*
+ * Build the op list that takes the DSP from the state left by config "from"
+ * to the state of config "to". Writes that would not change a DSP register
+ * and writes of the swap flag are dropped, bulk segments are trimmed to the bytes that change (short
+ * unchanged gaps are kept to save a transaction), and a delay is kept only
+ * when something was written since the previous one.
+ */
+static int tas3251_build_delta(struct tas3251_private *priv,
+			       const struct tas3251_fw_cfg *from,
+			       const struct tas3251_fw_cfg *to,
+			       struct tas3251_fw_cfg *delta)
+{
+	const struct tas3251_fw_op *op, *end = to->ops + to->num_ops;
+	struct tas3251_reg_val *state, *rv;
+	struct tas3251_fw_op *ops;
+	unsigned int nstate, n = 0, nvals = 0, bytes = 0, i, j, last, reg;
+	bool changed[TAS3251_PAGE_LEN], written = false;
+	u8 *vals;
+	int ret = -ENOMEM;
+
+	for (op = to->ops; op < end; op++)
+		if (op->type == TAS3251_FW_BULK)
+			bytes += op->len;
+	state = tas3251_cfg_state(priv, from, &nstate);
+	ops = kvmalloc_array(to->num_ops + bytes, sizeof(*ops), GFP_KERNEL);
+	vals = kvmalloc(bytes ? bytes : 1, GFP_KERNEL);
+	if (!state || !ops || !vals)
+		goto out;
+
+	for (op = to->ops; op < end; op++) {
+		if (op->type == TAS3251_FW_DELAY) {
+			if (written)
+				ops[n++] = *op;
+			written = false;
+			continue;
+		}
+		if (tas3251_swap_reg(op->reg))
+			continue;
+		if (!tas3251_delta_reg(priv, op->reg)) {
+			ops[n] = *op;
+			if (op->type == TAS3251_FW_BULK) {
+				ops[n].val = nvals;
+				memcpy(&vals[nvals], &to->vals[op->val], op->len);
+				nvals += op->len;
+			}
+			n++;
+			written = true;
+			continue;
+		}
+		for (i = 0; i < op->len; i++) {
+			reg = op->reg + i;
+			rv = bsearch(&reg, state, nstate, sizeof(*state), tas3251_reg_cmp);
+			changed[i] = !tas3251_swap_reg(reg) &&
+				     (!rv || (rv->val != tas3251_op_val(to, op, i)));
+			if (rv)
+				rv->val = tas3251_op_val(to, op, i);
+		}
+		for (i = 0; i < op->len; i = last + 1) {
+			last = i;
+			if (!changed[i])
+				continue;
+			for (j = i + 1; (j < op->len) && (j <= last + TAS3251_DELTA_GAP); j++)
+				if (changed[j])
+					last = j;
+			ops[n].reg = op->reg + i;
+			ops[n].len = last - i + 1;
+			if (ops[n].len == 1) {
+				ops[n].type = TAS3251_FW_WRITE;
+				ops[n].val = tas3251_op_val(to, op, i);
+			} else {
+				ops[n].type = TAS3251_FW_BULK;
+				ops[n].val = nvals;
+				memcpy(&vals[nvals], &to->vals[op->val + i], ops[n].len);
+				nvals += ops[n].len;
+			}
+			n++;
+			written = true;
+		}
+	}
+	ret = tas3251_store_cfg(delta, ops, n, vals, nvals);
+out:
+	kvfree(state);
+	kvfree(ops);
+	kvfree(vals);
+	return ret;
+}
+
+static size_t tas3251_cfg_bytes(const struct tas3251_fw_cfg *cfg)
+{
+	return cfg->valid ? cfg->num_ops * sizeof(*cfg->ops) + cfg->num_vals : 0;
+}
+
+/*
+ * Everything the firmware keeps resident: compiled configs and deltas. The
+ * images are released once compiled, so nothing else is held.
+ */
+static size_t tas3251_fw_bytes(struct tas3251_private *priv)
+{
+	size_t bytes = tas3251_cfg_bytes(&priv->dsp_base);
+	int i, j;
+
+	for (i = 0; i < priv->num_rates; i++) {
+		bytes += tas3251_cfg_bytes(&priv->dsp_cfg[i]);
+		for (j = 0; j < priv->num_rates; j++)
+			bytes += tas3251_cfg_bytes(&priv->dsp_delta[i][j]);
+	}
+	return bytes;
+}
+
+/* A dropped config is compiled again from its file when it is needed */
+static void tas3251_drop_cfg(struct tas3251_private *priv, int cfg)
+{
+	int i;
+
+	tas3251_free_cfg(&priv->dsp_cfg[cfg]);
+	for (i = 0; i < TAS3251_MAX_RATES; i++) {
+		tas3251_free_cfg(&priv->dsp_delta[cfg][i]);
+		tas3251_free_cfg(&priv->dsp_delta[i][cfg]);
+	}
+	priv->stats.evictions++;
+}
+
+/*
+ * Drop least recently used configs until the compiled firmware fits in
+ * fw_cache_kb. The config the DSP holds is never dropped.
+ */
+static void tas3251_evict(struct tas3251_private *priv)
+{
+	size_t cap = (size_t)fw_cache_kb * 1024;
+	int i, lru;
+
+	while (cap && (tas3251_fw_bytes(priv) > cap)) {
+		lru = -1;
+		for (i = 0; i < priv->num_rates; i++)
+			if ((i != priv->active_cfg) && priv->dsp_cfg[i].valid &&
+			    ((lru < 0) || (priv->fw_used[i] < priv->fw_used[lru])))
+				lru = i;
+		if (lru < 0)
+			break;
+		dev_dbg(priv->component->dev, "dropping config %d Hz", priv->samplerates[lru]);
+		tas3251_drop_cfg(priv, lru);
+	}
+}
+
+/*
+ * The file of a config, or the container for cfg < 0. A missing file is
+ * expected, so no fallback loader and no warning. A file found is added to
+ * the firmware cache, so it can be fetched again while the filesystem is not
+ * back yet during system resume. Runs on fw_wq only.
+ */
+static const struct firmware *tas3251_request_firmware(struct tas3251_private *priv, int cfg)
+{
+	int rate = (cfg < 0) ? 0 : priv->samplerates[cfg];
+	const struct firmware *fw;
 	char filename[128];
+
+	if (rate)
+		snprintf(filename, sizeof(filename), "tas3251/tas3251_%s_%d.bin", priv->fw_name, rate);
+	else
+		snprintf(filename, sizeof(filename), "tas3251/tas3251_%s.bin", priv->fw_name);
+	trace_tas3251_fw_load_start(priv->component->dev, priv->fw_name, rate, 0, 0, 0);
+	if (request_firmware_direct(&fw, filename, priv->component->dev))
+		return NULL;
+	if (!(priv->fw_cached & BIT(cfg + 1)) &&					// once per name
+	    !firmware_request_cache(priv->component->dev, filename))
+		priv->fw_cached |= BIT(cfg + 1);
+	return fw;
+}
+
+/* Compile the config of a rate from its part of a file image held by the caller */
+static int tas3251_compile_rate(struct tas3251_private *priv, int cfg,
+				const struct firmware *fw)
+{
+	int ret;
+
+	if ((priv->fw_off[cfg] > fw->size) || (priv->fw_len[cfg] > fw->size - priv->fw_off[cfg]))
+		return -EINVAL;
+	ret = tas3251_compile_firmware(priv, &fw->data[priv->fw_off[cfg]], priv->fw_len[cfg],
+				       &priv->dsp_cfg[cfg]);
+	if (!ret)
+		priv->stats.loads++;
+	return ret;
+}
+
+/* Index of the config for priv->rate, num_rates if there is none */
+static int tas3251_rate_cfg(struct tas3251_private *priv)
+{
+	int cfg = 0;
+
+	while ((cfg < priv->num_rates) && (priv->samplerates[cfg] != priv->rate))
+		cfg++;
+	return cfg;
+}
+
+/*
+ * The image of a dropped config that the next download needs, fetched
+ * without priv->lock held, so controls and DAI ops do not wait for the
+ * filesystem. During system resume it comes from the firmware cache.
+ * *cfg is the config it was fetched for.
+ */
+static const struct firmware *tas3251_fetch_cfg(struct tas3251_private *priv, int *cfg)
+{
+	bool fetch;
+	int file;
+
+	mutex_lock(&priv->lock);
+	*cfg = tas3251_rate_cfg(priv);
+	fetch = (priv->previous_rate != priv->rate) && (*cfg < priv->num_rates) &&
+		!priv->dsp_cfg[*cfg].valid && priv->fw_present[*cfg];
+	file = priv->fw_container ? -1 : *cfg;
+	mutex_unlock(&priv->lock);
+	return fetch ? tas3251_request_firmware(priv, file) : NULL;
+}
+
+/*
+ * Make the config of a rate resident, a dropped one is compiled again from
+ * fw as fetched by tas3251_fetch_cfg(). The caller releases fw.
+ */
+static int tas3251_load_cfg(struct tas3251_private *priv, int cfg,
+			    const struct firmware *fw)
+{
+	int ret;
+
+	if (!priv->dsp_cfg[cfg].valid) {
+		if (!fw)
+			return -ENOENT;
+		if (fw->size != (priv->fw_container ? priv->fw_size : priv->fw_len[cfg]))
+			ret = -ESTALE;							// replaced on disk
+		else
+			ret = tas3251_compile_rate(priv, cfg, fw);
+		trace_tas3251_fw_load_end(priv->component->dev, priv->fw_name, priv->samplerates[cfg],
+					  fw->size, priv->dsp_cfg[cfg].num_ops, ret);
+		if (ret)
+			return ret;
+	}
+	priv->fw_used[cfg] = ++priv->fw_tick;
+	return 0;
+}
+
+/*
+ * Rate switch op list between two resident configs, built on first use and
+ * kept until either config is dropped. Container rates are diffed on their
+ * full config, assembled only for this.
+ */
+static struct tas3251_fw_cfg *tas3251_get_delta(struct tas3251_private *priv,
+						 int from, int to)
+{
+	struct tas3251_fw_cfg *delta = &priv->dsp_delta[from][to];
+	struct tas3251_fw_cfg full[2] = { }, *a = &priv->dsp_cfg[from], *b = &priv->dsp_cfg[to];
+	int ret = 0;
+
+	if (delta->valid)
+		return delta;
+	if ((from == to) || !priv->dsp_cfg[from].valid || !priv->dsp_cfg[to].valid)
+		return NULL;
+	if (priv->dsp_base.valid) {
+		ret = tas3251_cat_cfg(&priv->dsp_base, &priv->dsp_cfg[from], &full[0]);
+		if (!ret)
+			ret = tas3251_cat_cfg(&priv->dsp_base, &priv->dsp_cfg[to], &full[1]);
+		a = &full[0];
+		b = &full[1];
+	}
+	if (!ret)
+		ret = tas3251_build_delta(priv, a, b, delta);
+	tas3251_free_cfg(&full[0]);
+	tas3251_free_cfg(&full[1]);
+	if (ret)
+		return NULL;
+	dev_dbg(priv->component->dev, "delta %d -> %d: %u of %u ops", priv->samplerates[from],
+		priv->samplerates[to], delta->num_ops, b->num_ops);
+	return delta;
+}
+
+/*
+ * Split a container into the base and the per-rate parts. Every part is
+ * compiled once to reject a malformed file up front; only the offsets are
+ * kept, a dropped rate part is compiled again from a new fetch of the file.
+ * The rate list is taken from the file.
+ */
+static int tas3251_load_container(struct tas3251_private *priv,
+				  const struct firmware *fw)
+{
+	const u8 *data = fw->data;
+	size_t size = fw->size;
+	const struct tas3251_fw_hdr *hdr = (const void *)data;
+	const struct tas3251_fw_rate *rates;
+	struct device *dev = priv->component->dev;
+	size_t pos, len;
+	unsigned int i, n;
+	int ret;
+
+	if ((size < sizeof(*hdr)) || (le32_to_cpu(hdr->magic) != TAS3251_FW_MAGIC))
+		return -ENOENT;
+	n = le16_to_cpu(hdr->num_rates);
+	if ((le16_to_cpu(hdr->version) != TAS3251_FW_VERSION) || !n || (n > TAS3251_MAX_RATES) ||
+	    (size < sizeof(*hdr) + n * sizeof(*rates)))
+		return -EINVAL;
+	rates = (const void *)(hdr + 1);
+	pos = sizeof(*hdr) + n * sizeof(*rates);
+	len = le32_to_cpu(hdr->base_len);
+	if (len > size - pos)
+		return -EINVAL;
+	ret = tas3251_compile_firmware(priv, &data[pos], len, &priv->dsp_base);
+	if (ret)
+		return ret;
+	pos += len;
+	for (i = 0; i < n; i++) {
+		len = le32_to_cpu(rates[i].len);
+		if (len > size - pos)
+			return -EINVAL;
+		priv->samplerates[i] = le32_to_cpu(rates[i].rate);
+		priv->fw_off[i] = pos;
+		priv->fw_len[i] = len;
+		ret = tas3251_compile_rate(priv, i, fw);
+		if (ret)
+			return ret;
+		priv->fw_present[i] = true;
+		priv->fw_used[i] = ++priv->fw_tick;
+		pos += len;
+	}
+	priv->num_rates = n;
+	priv->fw_container = true;
+	priv->fw_size = size;
+	dev_info(dev, "DSP firmware \"%.*s\" v%u, %u rates, base %u ops\n",
+		 (int)sizeof(hdr->name), hdr->name, le16_to_cpu(hdr->version), n,
+		 priv->dsp_base.num_ops);
+	return 0;
+}
+
+static void tas3251_free_firmware(struct tas3251_private *priv)
+{
+	int i, j;
+
+	tas3251_free_cfg(&priv->dsp_base);
+	for (i = 0; i < TAS3251_MAX_RATES; i++) {
+		tas3251_free_cfg(&priv->dsp_cfg[i]);
+		for (j = 0; j < TAS3251_MAX_RATES; j++)
+			tas3251_free_cfg(&priv->dsp_delta[i][j]);
+		priv->fw_present[i] = false;
+		priv->fw_off[i] = 0;
+		priv->fw_len[i] = 0;
+	}
+	priv->fw_container = false;
+	priv->fw_size = 0;
+	priv->active_cfg = -1;
+}
+
+/*
+ * Per-rate image lookup result. A valid image is compiled and released, the
+ * config is fetched and compiled again if it is dropped later.
+ */
+static void tas3251_rate_firmware(struct tas3251_private *priv, int i,
+				  const struct firmware *fw)
+{
+	struct device *dev = priv->component->dev;
+	int ret = 0;
+
+	if (!fw) {
+		dev_info(dev, "no firmware for %d Hz, using minimal config\n", priv->samplerates[i]);
+		ret = -ENOENT;
+	} else if ((fw->size < 2) || (fw->size & 1)) {
+		dev_err(dev, "firmware is invalid, using minimal config\n");
+		ret = -EINVAL;
+	} else {
+		priv->fw_off[i] = 0;
+		priv->fw_len[i] = fw->size;
+		ret = tas3251_compile_rate(priv, i, fw);
+		priv->fw_present[i] = !ret;
+		priv->fw_used[i] = ++priv->fw_tick;
+		if (ret)
+			dev_err(dev, "firmware is not loaded, using minimal config\n");
+	}
+	trace_tas3251_fw_load_end(dev, priv->fw_name, priv->samplerates[i], fw ? fw->size : 0,
+				  priv->dsp_cfg[i].num_ops, ret);
+	if (ret && (ret != -ENOENT)) {
+		dev_err(dev,"  Please provide valid firmware in /lib/firmware/tas3251\n");
+		dev_err(dev,"  Format: tas3251_<fw_name>.bin or tas3251_<fw_name>_<rate>.bin");
+	}
+	release_firmware(fw);
+}
+
+/*
+ * Runs on fw_wq ahead of any download. One lookup for the container, else
+ * one per rate of the default list; fw_done is completed when all are done.
+ */
+static void tas3251_fetch_work(struct work_struct *work)
+{
+	struct tas3251_private *priv = container_of(work, struct tas3251_private, fetch_work);
+	struct device *dev = priv->component->dev;
 	const struct firmware *fw;
+	int i, ret = -ENOENT;
+
+	fw = tas3251_request_firmware(priv, -1);
+	if (fw)
+		ret = tas3251_load_container(priv, fw);
+	trace_tas3251_fw_load_end(dev, priv->fw_name, 0, fw ? fw->size : 0,
+				  priv->dsp_base.num_ops, ret);
+	release_firmware(fw);								// compiled
+	if (ret) {
+		if (ret != -ENOENT)
+			dev_err(dev, "firmware container is invalid (%d), trying per-rate files\n", ret);
+		tas3251_free_firmware(priv);
+		memcpy(priv->samplerates, samplerates, sizeof(samplerates));
+		priv->num_rates = ARRAY_SIZE(samplerates);
+		for (i = 0; i < priv->num_rates; i++)
+			tas3251_rate_firmware(priv, i, tas3251_request_firmware(priv, i));
+	}
+	tas3251_evict(priv);
+	complete_all(&priv->fw_done);
+}
+
+static void tas3251_get_firmware(struct snd_soc_component *component) {
 	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
-	mutex_lock(&priv->lock);
+
 	if (device_property_read_string(component->dev, "firmware", &priv->fw_name))
 		priv->fw_name = "default";
 //		dev_info(component->dev, "Firmware name = %s", priv->fw_name);
-	for (i = 0; i < 4 ; i++) {
-		snprintf(filename, sizeof(filename), "tas3251/tas3251_%s_%d.bin", priv->fw_name, samplerates[i]);
-//		snprintf(filename, sizeof(filename), "tas3251/tas3251_%s_%d.bin", priv->fw_name, priv->samplerates[i]);
-		ret = request_firmware_direct(&fw, filename, component->dev);
-		if (!ret) {
-			priv->dsp_cfg_len[i] = fw->size;
-			priv->dsp_cfg_data[i] = devm_kmemdup(component->dev, fw->data, fw->size, GFP_KERNEL);
-//			dev_dbg(component->dev, "Firmware = %s\n", filename);
-//			dev_dbg(component->dev, "Firmware length: %zd\n", fw->size / 2); 
-			if (!priv->dsp_cfg_data[i]) {
-				dev_err(component->dev, "firmware is not loaded, using minimal config\n");
-				priv->dsp_cfg_len[i] = 0;
-				ret = 1;
-			}
-			if ((fw->size < 2) || (fw->size & 1)) {
-				dev_err(component->dev, "firmware is invalid, using minimal config\n");
-				priv->dsp_cfg_len[i] = 0;
-				ret = 1;
-			}
-		} else {
-			dev_err(component->dev, "firmware not found, using minimal config\n");
-			priv->dsp_cfg_len[i] = 0;
+	priv->component = component;
+	priv->num_rates = 0;
+	reinit_completion(&priv->fw_done);
+	queue_work(priv->fw_wq, &priv->fetch_work);
+}
+
+static bool tas3251_dsp_running(struct tas3251_private *priv)
+{
+	unsigned int val;
+
+	return !regmap_read(priv->regmap, TAS3251_POWER, &val) &&			// cached
+	       !(val & (TAS3251_DSPR | TAS3251_RQST));
+}
+
+/*
+ * Coefficients written to a DSP book land in the inactive buffer. Setting the
+ * swap flag makes the DSP exchange buffers on the next frame and clear the
+ * flag, so the update is glitch free. A DSP that is not running picks the
+ * swap up when it starts, so there is nothing to wait for then.
+ * Caller holds priv->lock.
+ */
+static int tas3251_dsp_swap(struct tas3251_private *priv)
+{
+	static const u8 swap[4] = { 0x00, 0x00, 0x00, TAS3251_SWAP };
+	unsigned int val;
+	int ret;
+
+	ret = tas3251_select_book(priv, TAS3251_BOOK_DSP);
+	if (!ret)
+		ret = regmap_bulk_write(priv->regmap, TAS3251_DSP_SWAP_FLAG, swap, sizeof(swap));
+	if (!ret && tas3251_dsp_running(priv))
+		ret = regmap_read_poll_timeout(priv->regmap, TAS3251_DSP_SWAP_FLAG + 3, val,
+					       !(val & TAS3251_SWAP), 1000, TAS3251_SWAP_TIMEOUT_US);
+	tas3251_select_book(priv, TAS3251_BOOK_CTRL);
+	return ret;
+}
+
+/* The stream's own swap: the last flag byte with the swap bit set */
+static bool tas3251_swap_op(const struct tas3251_fw_cfg *cfg, const struct tas3251_fw_op *op)
+{
+	return tas3251_swap_reg(op->reg) && (op->reg + op->len - 1 == TAS3251_DSP_SWAP_FLAG + 3) &&
+	       (tas3251_op_val(cfg, op, op->len - 1) & TAS3251_SWAP);
+}
+
+/*
+ * A swap in the stream is done with the polled handshake instead of a blind
+ * write. With swap set, coefficients written after the last swap are
+ * swapped in at the end. delta only tells the tracepoints what is running.
+ */
+static int tas3251_run_cfg(struct tas3251_private *priv,
+			   const struct tas3251_fw_cfg *cfg, bool delta, bool swap)
+{
+	const struct tas3251_fw_op *op, *end = cfg->ops + cfg->num_ops;
+	struct device *dev = priv->component->dev;
+	unsigned int xfers = 0, bytes = 0;
+	bool coeffs = false;
+	int ret = 0;
+
+	trace_tas3251_download_start(dev, priv->rate, delta, cfg->num_ops, 0, 0);
+	for (op = cfg->ops; op < end && !ret; op++) {
+		trace_tas3251_segment_start(dev, op->type, op->reg,
+					    op->type == TAS3251_FW_DELAY ? op->val : op->len, 0);
+		if (op->type == TAS3251_FW_DELAY) {
+			usleep_range(1000 * op->val, 1000 * op->val + 10000);
+			priv->stats.delay_ms += op->val;
+			trace_tas3251_segment_end(dev, op->type, op->reg, op->val, 0);
+			continue;
 		}
-		if (ret) {
-			dev_err(component->dev,"  Please provide valid firmware in /lib/firmware/tas3251\n");
-			dev_err(component->dev,"  Format: tas3251_<fw_name>_<rate>.bin");
+		if (tas3251_swap_op(cfg, op)) {
+			ret = tas3251_dsp_swap(priv);
+			coeffs = false;
+			xfers++;
+			trace_tas3251_segment_end(dev, op->type, op->reg, op->len, ret);
+			continue;
 		}
-	release_firmware(fw);
+		ret = tas3251_select_book(priv, TAS3251_REG_BOOK(op->reg));
+		if (ret)
+			break;
+		coeffs |= (priv->book != TAS3251_BOOK_CTRL);
+		if (op->type == TAS3251_FW_BULK)
+			ret = regmap_bulk_write(priv->regmap, op->reg, &cfg->vals[op->val], op->len);
+		else
+			ret = tas3251_write_cfg(priv, op->reg, op->val);
+		xfers++;
+		bytes += op->len;
+		trace_tas3251_segment_end(dev, op->type, op->reg, op->len, ret);
 	}
+	tas3251_select_book(priv, TAS3251_BOOK_CTRL);
+	if (!ret && swap && coeffs)
+		ret = tas3251_dsp_swap(priv);
+	priv->stats.xfers += xfers;
+	priv->stats.bytes += bytes;
+	trace_tas3251_download_end(dev, priv->rate, delta, xfers, bytes, ret);
+	return ret;
+}
+
+static bool tas3251_coeffs_valid(unsigned int book, unsigned int page, unsigned int reg,
+				 size_t len)
+{
+	return (book != TAS3251_BOOK_CTRL) && (book <= 0xff) && page && (page <= 0xff) &&
+	       (reg != TAS3251_PAGE_SEL) && len && (reg + len <= TAS3251_PAGE_LEN);
+}
+
+/* One bulk transfer into a DSP page. Caller holds priv->lock. */
+static int tas3251_write_block(struct tas3251_private *priv, unsigned int book,
+			       unsigned int page, unsigned int reg, const u8 *data, size_t len)
+{
+	int ret;
+
+	ret = tas3251_select_book(priv, book);
+	if (!ret)
+		ret = regmap_bulk_write(priv->regmap, TAS3251_REG(book, page, reg), data, len);
+	tas3251_select_book(priv, TAS3251_BOOK_CTRL);
+	return ret;
+}
+
+/**
+ * tas3251_write_coeffs - update DSP coefficients while audio keeps playing
+ * @dev: TAS3251 device
+ * @book: DSP book
+ * @page: page within the book
+ * @reg: first register, the block must stay within the page
+ * @data: coefficient bytes
+ * @len: number of bytes
+ *
+ * The block is written into the inactive buffer in one transfer and the
+ * buffers are swapped, without powering the DSP down.
+ */
+int tas3251_write_coeffs(struct device *dev, unsigned int book, unsigned int page,
+			 unsigned int reg, const u8 *data, size_t len)
+{
+	struct tas3251_private *priv = dev_get_drvdata(dev);
+	int ret;
+
+	if (!tas3251_coeffs_valid(book, page, reg, len))
+		return -EINVAL;
+
+	ret = pm_runtime_resume_and_get(dev);
+	if (ret < 0)
+		return ret;
+	mutex_lock(&priv->lock);
+	ret = tas3251_write_block(priv, book, page, reg, data, len);
+	if (!ret)
+		ret = tas3251_dsp_swap(priv);
+	priv->active_cfg = -1;							// deltas no longer apply
 	mutex_unlock(&priv->lock);
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
+	return ret;
 }
+EXPORT_SYMBOL_GPL(tas3251_write_coeffs);
 
 static void tas3251_write_firmware(struct snd_soc_component *component) {
 	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
-	int i = 0, cfg = 0;
+	struct tas3251_fw_cfg *delta;
+	const struct firmware *fw;
+	int cfg, fetched, ret;
+	ktime_t start;
 //	int samplerates[4] = {44100, 48000, 88200, 96000};
+	fw = tas3251_fetch_cfg(priv, &fetched);
 	mutex_lock(&priv->lock);
 	dev_dbg(component->dev, "Previous rate is %d", priv->previous_rate);
 //	dev_dbg(component->dev, "Sample rate = %d\n", priv->rate);
-	regmap_update_bits(priv->regmap, TAS3251_POWER, TAS3251_DSPR, 0);
-	while ((samplerates[cfg] != priv->rate) && (cfg < 4)) cfg++ ;
+	cfg = tas3251_rate_cfg(priv);
 //	while ((priv->samplerates[cfg] != priv->rate) && (cfg < 4)) cfg++ ;
+	if (cfg != fetched)								// rate changed, the
+		goto out;								// work is queued again
+	regmap_update_bits(priv->regmap, TAS3251_POWER, TAS3251_DSPR, 0);
 	if (priv->previous_rate == priv->rate) {
 		dev_dbg(component->dev, "writing dsp config not necessary");
+		priv->stats.skipped++;
 		goto skip_write;
 	}
-	if (priv->dsp_cfg_len[cfg] == 0) {
+	if ((cfg == priv->num_rates) || tas3251_load_cfg(priv, cfg, fw)) {
 		dev_dbg(component->dev, "writing dsp config not possible");
 		goto skip_write;
 	}
-	dev_dbg(component->dev, "start writing dsp config");
-	while (i < priv->dsp_cfg_len[cfg]) {
-		switch (priv->dsp_cfg_data[cfg][i]) {
-		case CFG_META_DELAY:
-			usleep_range((1000 * priv->dsp_cfg_data[cfg][i + 1]), (1000 * priv->dsp_cfg_data[cfg][i + 1]) + 10000);
-			i++;
-			break;
-		case CFG_META_BURST:
-			regmap_bulk_write(priv->regmap, priv->dsp_cfg_data[cfg][i + 2], &priv->dsp_cfg_data[cfg][i + 3], priv->dsp_cfg_data[cfg][i + 1] - 1);
-			i +=  priv->dsp_cfg_data[cfg][i + 1];
-			break;
-		case CFG_ASCII_TEXT:									// skip n = fw->data[i + 1] - 1 ascii characters
-			i +=  priv->dsp_cfg_data[cfg][i + 1];
-			break;
-		default:
-			regmap_write(priv->regmap, priv->dsp_cfg_data[cfg][i], priv->dsp_cfg_data[cfg][i + 1]);
-			i++;
-		}
-	i++;
+	start = ktime_get();
+	priv->stats.downloads++;
+	delta = (priv->active_cfg >= 0) ? tas3251_get_delta(priv, priv->active_cfg, cfg) : NULL;
+	if (delta) {
+		dev_dbg(component->dev, "start writing dsp config delta");			// into the
+		ret = tas3251_run_cfg(priv, delta, true, true);				// inactive buffer
+	} else {
+		/*
+		 * A full stream may load a new DSP program and carries PPC3's own
+		 * power sequence, which the coefficient swap does not cover. Only
+		 * its swap goes through the handshake.
+		 */
+		dev_dbg(component->dev, "start writing dsp config");
+		ret = priv->dsp_base.num_ops ? tas3251_run_cfg(priv, &priv->dsp_base, false, false) : 0;
+		if (!ret)									// swap in what
+			ret = tas3251_run_cfg(priv, &priv->dsp_cfg[cfg], false,		// follows the base
+					      priv->dsp_base.valid);
+	}
+	tas3251_hist_add(priv->stats.download_us, start);
+	if (ret) {
+		dev_err(component->dev, "Failed to write DSP config: %d\n", ret);
+		priv->previous_rate = 0;
+		priv->active_cfg = -1;
+		goto out;
 	}
-	dev_info(component->dev, "DSP config \"tas3251_%s_%d.bin\" written\n", priv->fw_name, priv->rate);
+	priv->dsp_programmed = true;
+	priv->active_cfg = cfg;
+	tas3251_evict(priv);
+	dev_info(component->dev, "DSP config \"%s\" %d Hz written\n", priv->fw_name, priv->rate);
 skip_write:
 	priv->previous_rate = priv->rate;
+out:
 	mutex_unlock(&priv->lock);
+	release_firmware(fw);								// compiled
+}
+
+/*
+ * The download runs on an ordered workqueue, so hw_params returns as soon as
+ * the rate is known and the machine driver's clock change and the buffer
+ * setup overlap with it. prepare and unmute wait for it.
+ */
+static void tas3251_fw_work(struct work_struct *work)
+{
+	struct tas3251_private *priv = container_of(work, struct tas3251_private, fw_work);
+	struct device *dev = priv->component->dev;
+
+	if (!wait_for_completion_timeout(&priv->fw_done, msecs_to_jiffies(TAS3251_FW_TIMEOUT_MS)))
+		dev_err(dev, "Timed out waiting for firmware\n");
+	if (pm_runtime_resume_and_get(dev) < 0)
+		return;
+	tas3251_write_firmware(priv->component);
+	pm_runtime_mark_last_busy(dev);
+	pm_runtime_put_autosuspend(dev);
+}
+
+static void tas3251_queue_firmware(struct tas3251_private *priv)
+{
+	cancel_work(&priv->fw_work);						// drop a stale rate,
+	queue_work(priv->fw_wq, &priv->fw_work);				// a running one is redone
 }
 
 static int tas3251_set_dai_fmt(struct snd_soc_dai *codec_dai,
@@ -187,8 +1239,10 @@ static int tas3251_set_dai_fmt(struct snd_soc_dai *codec_dai,
 {
 	struct snd_soc_component *component = codec_dai->component;
 	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
-	u8 val, ret, offset = 0x00;
+	u8 val, offset = 0x00;
+	int ret;
 
+	trace_tas3251_set_dai_fmt_start(component->dev, format, 0);
 //	dev_dbg(component->dev, "Format = 0x%x\n", format);
 	priv->format = format;
 //	regmap_update_bits(priv->regmap, TAS3251_POWER,
@@ -219,16 +1273,22 @@ static int tas3251_set_dai_fmt(struct snd_soc_dai *codec_dai,
 		return -EINVAL;
 	}
 
+	ret = pm_runtime_resume_and_get(component->dev);				// CLOCK_STATUS is
+	if (ret < 0) {									// read from the chip
+		trace_tas3251_set_dai_fmt_end(component->dev, format, ret);
+		return ret;
+	}
+	mutex_lock(&priv->lock);							// book 0, no download
 	ret = regmap_update_bits(priv->regmap, TAS3251_I2S_1, TAS3251_AFMT, val << 4);
 	if (ret != 0) {
 		dev_err(component->dev, "Failed to set data format: %d\n", ret);
-		return ret;
+		goto out;
 	}
 
 	ret = regmap_write(priv->regmap, TAS3251_I2S_2, offset);
 	if (ret != 0) {
 		dev_err(component->dev, "Failed to set data offset: %x\n", offset);
-		return ret;
+		goto out;
 	}
 
 	switch (format & SND_SOC_DAIFMT_CLOCK_PROVIDER_MASK) {						// 0xf000
@@ -255,14 +1315,15 @@ static int tas3251_set_dai_fmt(struct snd_soc_dai *codec_dai,
 		if (regmap_test_bits(priv->regmap, TAS3251_CLOCK_STATUS, TAS3251_CDST6_ERR)) {		// 0x5f, 0x40
 			dev_err(component->dev,
 				"Need MCLK for master mode:\n        45.1585 / 49.152 MHz\n");
-		return -EIO;
+			ret = -EIO;
+			goto out;
 		}
 		regmap_update_bits(priv->regmap, TAS3251_ERROR_DETECT,					// 0x25
 			TAS3251_IDCH_ERR | TAS3251_IPLK_ERR, 0 | TAS3251_IPLK_ERR);			// 0x08 | 0x01, 0 | 0x01
 		regmap_update_bits(priv->regmap, TAS3251_SCLK_LRCLK_CFG,				// 0x09
 			TAS3251_CLK_CFG_MASK, TAS3251_CLK_OE);						// 0x91, 0x11
 		regmap_write(priv->regmap, TAS3251_MASTER_CLKDIV_1, 0x0f);				// 0x20, 0x0f
-		regmap_write(priv->regmap, TAS3251_MASTER_CLKDIV_2, 0x3f);				// 0x21, 0x3f
+		regmap_write(priv->regmap, TAS3251_MASTER_CLKDIV_2, priv->bclk_ratio - 1);		// 0x21, 0x3f
 		regmap_update_bits(priv->regmap, TAS3251_MASTER_MODE,					// 0x0c
 			TAS3251_CLKDIV_EN, TAS3251_CLKDIV_EN);						// 0x03, 0x03
 
@@ -270,41 +1331,140 @@ static int tas3251_set_dai_fmt(struct snd_soc_dai *codec_dai,
 
 		default:
 		dev_err(component->dev, "Format unsupported\n");
-		return -EINVAL;
+		ret = -EINVAL;
+		goto out;
 	}
 	priv->rate = DEFAULT_RATE;
-	tas3251_get_firmware(component);
-	tas3251_write_firmware(component);
-	return 0;
+	tas3251_queue_firmware(priv);
+out:
+	mutex_unlock(&priv->lock);
+	pm_runtime_mark_last_busy(component->dev);
+	pm_runtime_put_autosuspend(component->dev);
+	trace_tas3251_set_dai_fmt_end(component->dev, format, ret);
+	return ret;
 }
 
 static int tas3251_mute(struct snd_soc_dai *dai, int mute, int direction)
 {
 	struct snd_soc_component *component = dai->component;
 	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
+	ktime_t start = ktime_get();
 	int ret;
+
+	trace_tas3251_mute_start(component->dev, mute, 0);
+	if (!mute) flush_work(&priv->fw_work);						// DSP config in place
+	mutex_lock(&priv->lock);
 	if (!mute) regmap_update_bits(priv->regmap, TAS3251_POWER,					// 0x02
 		TAS3251_DSPR | TAS3251_RQST, 0);							// 0x80 | 0x10, 0
 	usleep_range(1e3, 2e3);
 	dev_dbg(component->dev, "Mute = 0x%x\n", mute);
 	ret = regmap_update_bits(priv->regmap, TAS3251_MUTE,						// 0x03
 				 TAS3251_MUTE_MASK, mute ? TAS3251_MUTE_MASK : 0);			// 0x11, 0x11 : 0
+	if (!mute && priv->resume_start) {							// first sample
+		tas3251_hist_add(priv->stats.resume_us, priv->resume_start);			// since resume
+		priv->resume_start = 0;
+	}
 	usleep_range(1e3, 2e3);
 	if (mute) regmap_update_bits(priv->regmap, TAS3251_POWER,					// 0x02
 		TAS3251_DSPR | TAS3251_RQST, TAS3251_DSPR | TAS3251_RQST);				// 0x80 | 0x10, 0x90 : 0
+	mutex_unlock(&priv->lock);
+	tas3251_hist_add(priv->stats.mute_us, start);
+	trace_tas3251_mute_end(component->dev, mute, ret);
 	if (ret < 0)
 		return ret;
 	return 0;
 }
 
+/*
+ * Producer mode: BCLK = MCLK / CLKDIV_1, LRCLK = BCLK / CLKDIV_2. Without a
+ * set_sysclk the MCLK is that of the rate's family, 45.1584 MHz for multiples
+ * of 11025 Hz and 49.152 MHz for multiples of 8 kHz. Caller holds priv->lock.
+ */
+static int tas3251_set_clkdiv(struct snd_soc_component *component, unsigned int rate)
+{
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
+	unsigned int mclk = priv->sysclk, bclk = rate * priv->bclk_ratio;
+	int ret;
+
+	if (!mclk)
+		mclk = (rate % 8000) ? TAS3251_MCLK_44K1 : TAS3251_MCLK_48K;
+	if (!bclk || (mclk % bclk) || (mclk / bclk > 128)) {
+		dev_err(component->dev, "No divider for %u Hz, %u BCLK from %u Hz MCLK\n",
+			rate, priv->bclk_ratio, mclk);
+		return -EINVAL;
+	}
+	dev_dbg(component->dev, "MCLK %u Hz, BCLK divider %u", mclk, mclk / bclk);
+	ret = regmap_write(priv->regmap, TAS3251_MASTER_CLKDIV_1, mclk / bclk - 1);		// 0x20
+	if (!ret)
+		ret = regmap_write(priv->regmap, TAS3251_MASTER_CLKDIV_2, priv->bclk_ratio - 1);	// 0x21
+	return ret;
+}
+
+static int tas3251_set_sysclk(struct snd_soc_dai *dai, int clk_id,
+			      unsigned int freq, int dir)
+{
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(dai->component);
+
+	priv->sysclk = freq;
+	return 0;
+}
+
+static int tas3251_set_bclk_ratio(struct snd_soc_dai *dai, unsigned int ratio)
+{
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(dai->component);
+
+	if ((ratio < 2) || (ratio > 256))
+		return -EINVAL;
+	priv->bclk_ratio = ratio;
+	return 0;
+}
+
+/* Rates that have a firmware file, resident or not; 0 while loading */
+static unsigned int tas3251_fw_rates(struct tas3251_private *priv, unsigned int *rates)
+{
+	unsigned int i, n = 0;
+
+	if (!completion_done(&priv->fw_done))
+		return 0;
+	for (i = 0; i < priv->num_rates; i++)
+		if (priv->fw_present[i])
+			rates[n++] = priv->samplerates[i];
+	return n;
+}
+
+/*
+ * Only offer the rates the DSP has a config for, so userspace converts to one
+ * of those instead of playing unprocessed audio. Without any firmware every
+ * rate plays with the minimal config, as before.
+ */
+static int tas3251_startup(struct snd_pcm_substream *substream,
+			   struct snd_soc_dai *dai)
+{
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(dai->component);
+
+	if (!wait_for_completion_timeout(&priv->fw_done, msecs_to_jiffies(TAS3251_FW_TIMEOUT_MS)))
+		return 0;
+	mutex_lock(&priv->lock);
+	priv->rate_constraint.list = priv->fw_rates;
+	priv->rate_constraint.count = tas3251_fw_rates(priv, priv->fw_rates);
+	mutex_unlock(&priv->lock);
+	if (!priv->rate_constraint.count)
+		return 0;
+	return snd_pcm_hw_constraint_list(substream->runtime, 0, SNDRV_PCM_HW_PARAM_RATE,
+					  &priv->rate_constraint);
+}
+
 static int tas3251_hw_params(struct snd_pcm_substream *substream,
 			     struct snd_pcm_hw_params *params,
 			     struct snd_soc_dai *dai)
 {
 	struct snd_soc_component *component = dai->component;
 	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
-	u8 val, ret = 0;
+	ktime_t start = ktime_get();
+	u8 val;
+	int ret;
 
+	mutex_lock(&priv->lock);							// book 0, no download
 	priv->rate = params_rate(params);
 /*
 	dev_dbg(component->dev, "hw_params %u Hz, %u channels, %u bit\n",
@@ -312,30 +1472,12 @@ static int tas3251_hw_params(struct snd_pcm_substream *substream,
 		params_channels(params),
 		params_width(params));
 */
-	switch (params_rate(params)) {
-		case 96000:
-		case 88200:
-			val = 0x07;
-			break;
-		case 48000:
-		case 44100:
-			val = 0x0f;
-			break;
-/*
-		case 32000:
-			val = 0x17;
-			break;
-*/
-		default:
-			return -EINVAL;
-		}
-
-		if ((priv->format & SND_SOC_DAIFMT_CLOCK_PROVIDER_MASK) == SND_SOC_DAIFMT_CBP_CFP) {
-			ret = regmap_write(priv->regmap, TAS3251_MASTER_CLKDIV_1, val);
-		}
+	if ((priv->format & SND_SOC_DAIFMT_CLOCK_PROVIDER_MASK) == SND_SOC_DAIFMT_CBP_CFP) {
+		ret = tas3251_set_clkdiv(component, params_rate(params));
 		if (ret != 0) {
 			dev_err(component->dev, "Failed to set clock divider: %d\n", ret);
-			return ret;
+			goto out;
+		}
 	}
 //	dev_dbg(component->dev, "Clkdiv set\n");
 	switch (params_width(params)) {
@@ -353,33 +1495,348 @@ static int tas3251_hw_params(struct snd_pcm_substream *substream,
 			break;
 		default:
 			dev_err(component->dev, "Invalid width\n");
-			return -EINVAL;
+			ret = -EINVAL;
+			goto out;
 	}
 
 	ret = regmap_update_bits(priv->regmap, TAS3251_I2S_1, TAS3251_ALEN, val << 0);
 	if (ret != 0) {
 		dev_err(component->dev, "Failed to set data format: %d\n", ret);
-		return ret;
+		goto out;
 	}
 //	dev_dbg(component->dev, "End of tas3251_hw_params\n");
-//	tas3251_get_firmware(component);
-	tas3251_write_firmware(component);
+	tas3251_queue_firmware(priv);
+	tas3251_hist_add(priv->stats.hw_params_us, start);
+out:
+	mutex_unlock(&priv->lock);
+	return ret;
+}
+
+static int tas3251_prepare(struct snd_pcm_substream *substream,
+			   struct snd_soc_dai *dai)
+{
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(dai->component);
+
+	flush_work(&priv->fw_work);
 	return 0;
 }
 
 static const struct snd_soc_dai_ops tas3251_dai_ops = {
+	.startup	= tas3251_startup,
 	.set_fmt	= tas3251_set_dai_fmt,
+	.set_sysclk	= tas3251_set_sysclk,
+	.set_bclk_ratio	= tas3251_set_bclk_ratio,
 	.hw_params	= tas3251_hw_params,
+	.prepare	= tas3251_prepare,
 	.mute_stream	= tas3251_mute,
 	.no_capture_mute = 1,
 };
 
 static const DECLARE_TLV_DB_SCALE(tas3251_dac_tlv, -10350, 50, 1);
 
+static int tas3251_rates_info(struct snd_kcontrol *kcontrol,
+			      struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = TAS3251_MAX_RATES;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = 384000;
+	return 0;
+}
+
+/* Sample rates with DSP firmware, unused entries are 0 */
+static int tas3251_rates_get(struct snd_kcontrol *kcontrol,
+			     struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
+	unsigned int rates[TAS3251_MAX_RATES], i, n;
+
+	mutex_lock(&priv->lock);
+	n = tas3251_fw_rates(priv, rates);
+	mutex_unlock(&priv->lock);
+	for (i = 0; i < TAS3251_MAX_RATES; i++)
+		ucontrol->value.integer.value[i] = (i < n) ? rates[i] : 0;
+	return 0;
+}
+
+/*
+ * Caller holds priv->vol_lock. The registers have defaults, so this reads
+ * the cache, also while the codec is suspended.
+ */
+static int tas3251_vol_read(struct tas3251_private *priv, u8 *vol)
+{
+	unsigned int val[2];
+	int ret;
+
+	if (priv->vol_pending) {
+		memcpy(vol, priv->vol, sizeof(priv->vol));
+		return 0;
+	}
+	ret = regmap_read(priv->regmap, TAS3251_DIG_VOL_LEFT, &val[0]);			// cached
+	if (!ret)
+		ret = regmap_read(priv->regmap, TAS3251_DIG_VOL_RIGHT, &val[1]);
+	if (ret) {
+		dev_err(priv->component->dev, "Failed to read volume: %d\n", ret);
+		return ret;
+	}
+	vol[0] = val[0];
+	vol[1] = val[1];
+	return 0;
+}
+
+static int tas3251_vol_get(struct snd_kcontrol *kcontrol,
+			   struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
+	struct soc_mixer_control *mc = (struct soc_mixer_control *)kcontrol->private_value;
+	u8 vol[2];
+	int ret;
+
+	mutex_lock(&priv->vol_lock);
+	ret = tas3251_vol_read(priv, vol);
+	mutex_unlock(&priv->vol_lock);
+	if (ret)
+		return ret;
+	ucontrol->value.integer.value[0] = mc->max - vol[0];				// inverted
+	ucontrol->value.integer.value[1] = mc->max - vol[1];
+	return 0;
+}
+
+/*
+ * A slider drag produces a burst of puts. Only the latest left/right pair is
+ * kept and written by tas3251_vol_work at most TAS3251_VOL_DELAY_MS later.
+ */
+static int tas3251_vol_put(struct snd_kcontrol *kcontrol,
+			   struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
+	struct soc_mixer_control *mc = (struct soc_mixer_control *)kcontrol->private_value;
+	int max = mc->platform_max ? mc->platform_max : mc->max;
+	long left = ucontrol->value.integer.value[0], right = ucontrol->value.integer.value[1];
+	u8 vol[2];
+	int changed, ret;
+
+	if ((left < 0) || (left > max) || (right < 0) || (right > max))
+		return -EINVAL;
+	mutex_lock(&priv->vol_lock);
+	ret = tas3251_vol_read(priv, vol);
+	if (ret) {
+		mutex_unlock(&priv->vol_lock);
+		return ret;
+	}
+	changed = (vol[0] != mc->max - left) || (vol[1] != mc->max - right);
+	if (changed) {
+		priv->vol[0] = mc->max - left;
+		priv->vol[1] = mc->max - right;
+		priv->vol_pending = true;
+	}
+	mutex_unlock(&priv->vol_lock);
+	if (changed)
+		schedule_delayed_work(&priv->vol_work, msecs_to_jiffies(TAS3251_VOL_DELAY_MS));
+	return changed;
+}
+
+/* Both channels in one transfer, in book 0 between DSP downloads */
+static void tas3251_vol_work(struct work_struct *work)
+{
+	struct tas3251_private *priv = container_of(work, struct tas3251_private, vol_work.work);
+	int ret;
+
+	mutex_lock(&priv->lock);
+	mutex_lock(&priv->vol_lock);
+	ret = regmap_bulk_write(priv->regmap, TAS3251_DIG_VOL_LEFT, priv->vol, 2);	// 0x3d, 0x3e
+	if (ret)
+		dev_err(priv->component->dev, "Failed to set volume: %d\n", ret);
+	priv->vol_pending = false;
+	mutex_unlock(&priv->vol_lock);
+	mutex_unlock(&priv->lock);
+}
+
+/* On: volume steps 0.5 dB every 4 samples, off: it jumps */
+static int tas3251_ramp_get(struct snd_kcontrol *kcontrol,
+			    struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
+	unsigned int val;
+
+	mutex_lock(&priv->lock);
+	regmap_read(priv->regmap, TAS3251_DIG_MUTE_1, &val);				// 0x3f, cached
+	mutex_unlock(&priv->lock);
+	ucontrol->value.integer.value[0] = (val & TAS3251_VOL_FREQ_MASK) != TAS3251_VOL_IMMEDIATE;
+	return 0;
+}
+
+static int tas3251_ramp_put(struct snd_kcontrol *kcontrol,
+			    struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
+	bool changed;
+	int ret;
+
+	mutex_lock(&priv->lock);
+	ret = regmap_update_bits_check(priv->regmap, TAS3251_DIG_MUTE_1, TAS3251_VOL_FREQ_MASK,
+				       ucontrol->value.integer.value[0] ?
+				       TAS3251_VOL_RAMP : TAS3251_VOL_IMMEDIATE, &changed);
+	mutex_unlock(&priv->lock);
+	return ret ? ret : changed;
+}
+
+/*
+ * All meter words come in with one bulk read per meter_interval_ms, control
+ * reads are served from the copy. Reads keep the work going; it stops after
+ * TAS3251_METER_IDLE_MS without one. A suspended codec plays nothing, so its
+ * meters read 0 without waking it.
+ */
+static void tas3251_meter_work(struct work_struct *work)
+{
+	struct tas3251_private *priv = container_of(work, struct tas3251_private, meter_work.work);
+	struct device *dev = priv->component->dev;
+	u8 buf[TAS3251_MAX_METERS * 4];
+	unsigned int i;
+	int ret = -EAGAIN;
+
+	spin_lock(&priv->meter_lock);
+	if (time_after(jiffies, priv->meter_read + msecs_to_jiffies(TAS3251_METER_IDLE_MS))) {
+		priv->meter_running = false;
+		spin_unlock(&priv->meter_lock);
+		return;
+	}
+	spin_unlock(&priv->meter_lock);
+
+	if (pm_runtime_get_if_in_use(dev) > 0) {
+		mutex_lock(&priv->lock);
+		ret = tas3251_select_book(priv, TAS3251_REG_BOOK(priv->meter_reg));
+		if (!ret)
+			ret = regmap_bulk_read(priv->regmap, priv->meter_reg, buf, 4 * priv->meter_words);
+		tas3251_select_book(priv, TAS3251_BOOK_CTRL);
+		mutex_unlock(&priv->lock);
+		pm_runtime_put_autosuspend(dev);
+	}
+
+	spin_lock(&priv->meter_lock);
+	for (i = 0; i < priv->meter_words; i++)
+		priv->meter[i] = ret ? 0 : get_unaligned_be32(&buf[4 * i]);
+	spin_unlock(&priv->meter_lock);
+	schedule_delayed_work(&priv->meter_work, msecs_to_jiffies(max(meter_interval_ms, 10U)));
+}
+
+static int tas3251_meter_info(struct snd_kcontrol *kcontrol,
+			      struct snd_ctl_elem_info *uinfo)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
+
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = priv->meter_words;
+	uinfo->value.integer.min = INT_MIN;
+	uinfo->value.integer.max = INT_MAX;
+	return 0;
+}
+
+/* Raw signed DSP words, the scaling is set by the PPC3 design */
+static int tas3251_meter_get(struct snd_kcontrol *kcontrol,
+			     struct snd_ctl_elem_value *ucontrol)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
+	unsigned int i;
+	bool start;
+
+	spin_lock(&priv->meter_lock);
+	for (i = 0; i < priv->meter_words; i++)
+		ucontrol->value.integer.value[i] = (s32)priv->meter[i];
+	priv->meter_read = jiffies;
+	start = !priv->meter_running;
+	priv->meter_running = true;
+	spin_unlock(&priv->meter_lock);
+	if (start)
+		schedule_delayed_work(&priv->meter_work, 0);
+	return 0;
+}
+
+static const struct snd_kcontrol_new tas3251_meter_control = {
+	.iface	= SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name	= "DSP Level Meter",
+	.access	= SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE,
+	.info	= tas3251_meter_info,
+	.get	= tas3251_meter_get,
+};
+
+/*
+ * "DSP Coefficients" upload, written with the TLV ioctl. The data starts with
+ * the { type, length } header alsa-lib passes on, as for the SOF bytes
+ * controls, and length bytes follow it:
+ * { flags, 0, 0, 0 } followed by one or more blocks
+ * { book, page, reg, len } + len bytes, each inside one DSP page.
+ * The whole upload is checked before anything is written, every block is one
+ * transfer, and TAS3251_COEFF_SWAP swaps the buffers once at the end.
+ */
+static int tas3251_coeffs_put(struct snd_kcontrol *kcontrol,
+			      const unsigned int __user *bytes, unsigned int size)
+{
+	struct snd_soc_component *component = snd_soc_kcontrol_component(kcontrol);
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
+	const struct snd_ctl_tlv __user *tlvd = (const struct snd_ctl_tlv __user *)bytes;
+	struct snd_ctl_tlv header;
+	const u8 *blk, *end;
+	u8 *buf;
+	int ret = -EINVAL;
+
+	if (size < sizeof(header))
+		return -EINVAL;
+	if (copy_from_user(&header, tlvd, sizeof(header)))
+		return -EFAULT;
+	if ((header.length < 8) || (header.length > size - sizeof(header)) ||
+	    (header.length > TAS3251_COEFF_MAX))
+		return -EINVAL;
+	buf = memdup_user(tlvd->tlv, header.length);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+	end = buf + header.length;
+	for (blk = buf + 4; blk < end; blk += 4 + blk[3])
+		if ((end - blk < 4) || (end - blk - 4 < blk[3]) ||
+		    !tas3251_coeffs_valid(blk[0], blk[1], blk[2], blk[3]))
+			goto out;
+
+	ret = pm_runtime_resume_and_get(component->dev);
+	if (ret < 0)
+		goto out;
+	mutex_lock(&priv->lock);
+	for (blk = buf + 4; !ret && (blk < end); blk += 4 + blk[3])
+		ret = tas3251_write_block(priv, blk[0], blk[1], blk[2], &blk[4], blk[3]);
+	if (!ret && (buf[0] & TAS3251_COEFF_SWAP))
+		ret = tas3251_dsp_swap(priv);
+	priv->active_cfg = -1;							// deltas no longer apply
+	mutex_unlock(&priv->lock);
+	pm_runtime_mark_last_busy(component->dev);
+	pm_runtime_put_autosuspend(component->dev);
+	if (ret)
+		dev_err(component->dev, "Failed to upload coefficients: %d\n", ret);
+out:
+	kfree(buf);
+	return ret;
+}
+
 static const struct snd_kcontrol_new tas3251_controls[] = {
-	SOC_DOUBLE_R_TLV("Digital Playback Volume", TAS3251_DIG_VOL_LEFT,
-		 	 TAS3251_DIG_VOL_RIGHT, 0, 255, 1,
-			 tas3251_dac_tlv),
+	SOC_DOUBLE_R_EXT_TLV("Digital Playback Volume", TAS3251_DIG_VOL_LEFT,
+			     TAS3251_DIG_VOL_RIGHT, 0, 255, 1,
+			     tas3251_vol_get, tas3251_vol_put, tas3251_dac_tlv),
+	SOC_SINGLE_EXT("Digital Volume Ramp Switch", TAS3251_DIG_MUTE_1, 0, 1, 0,
+		       tas3251_ramp_get, tas3251_ramp_put),
+	{
+		.iface	= SNDRV_CTL_ELEM_IFACE_MIXER,
+		.name	= "DSP Sample Rates",
+		.access	= SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE,
+		.info	= tas3251_rates_info,
+		.get	= tas3251_rates_get,
+	},
+	SND_SOC_BYTES_TLV("DSP Coefficients", TAS3251_COEFF_MAX + sizeof(struct snd_ctl_tlv),
+			  NULL, tas3251_coeffs_put),
 };
 
 static const struct snd_soc_dapm_widget tas3251_dapm_widgets[] = {
@@ -408,28 +1865,284 @@ static struct snd_soc_dai_driver tas3251_dai = {
 	.ops = &tas3251_dai_ops,
 };
 
+static const struct regmap_range_cfg tas3251_range = {
+	.name			= "Pages",
+	.range_min		= TAS3251_VIRT_BASE,
+	.range_max		= TAS3251_MAX_REGISTER,
+	.selector_reg		= TAS3251_PAGE_SEL,
+	.selector_mask		= 0xff,
+	.selector_shift		= 0,
+	.window_start		= 0,
+	.window_len		= TAS3251_PAGE_LEN,
+};
+
+static const struct regmap_range tas3251_readable_ranges[] = {
+	regmap_reg_range(TAS3251_PAGE_SEL, TAS3251_PAGE_SEL),
+	regmap_reg_range(TAS3251_BOOK_SEL, TAS3251_BOOK_SEL),
+	regmap_reg_range(TAS3251_REG(TAS3251_BOOK_CTRL, 0x00, 0x00),			// control port
+			 TAS3251_REG(TAS3251_BOOK_CTRL, 0xff, 0x7f)),
+	regmap_reg_range(TAS3251_REG(TAS3251_BOOK_DSP, 0x00, 0x00),			// DSP books
+			 TAS3251_MAX_REGISTER),
+};
+
+static const struct regmap_access_table tas3251_readable_table = {
+	.yes_ranges		= tas3251_readable_ranges,
+	.n_yes_ranges		= ARRAY_SIZE(tas3251_readable_ranges),
+};
+
+static const struct regmap_range tas3251_volatile_ranges[] = {
+	regmap_reg_range(TAS3251_RESET, TAS3251_RESET),					// self clearing
+	regmap_reg_range(TAS3251_RATE_DET_1, TAS3251_CLOCK_STATUS),			// rate detect, clock status
+	regmap_reg_range(TAS3251_ANALOG_MUTE_DET, TAS3251_ANALOG_MUTE_DET),
+	regmap_reg_range(TAS3251_GPIN, TAS3251_DIGITAL_MUTE_DET),
+	regmap_reg_range(TAS3251_DSP_SWAP_FLAG, TAS3251_DSP_SWAP_FLAG + 3),		// cleared by the DSP
+};
+
+/* The level meter words are written by the DSP, their place comes from DT */
+static bool tas3251_volatile_reg(struct device *dev, unsigned int reg)
+{
+	struct tas3251_private *priv = dev_get_drvdata(dev);
+
+	if (priv && priv->meter_words && (reg >= priv->meter_reg) &&
+	    (reg < priv->meter_reg + 4 * priv->meter_words))
+		return true;
+	return regmap_reg_in_ranges(reg, tas3251_volatile_ranges,
+				    ARRAY_SIZE(tas3251_volatile_ranges));
+}
+
+/*
+ * A paged register is only written with its book selected, so nothing lands
+ * in the wrong book, and regcache_sync() restores the selected book alone.
+ * priv->book only changes under priv->lock, which every book switch holds.
+ */
+static bool tas3251_writeable_reg(struct device *dev, unsigned int reg)
+{
+	struct tas3251_private *priv = dev_get_drvdata(dev);
+
+	if (!priv || (reg < TAS3251_VIRT_BASE))
+		return true;
+	return TAS3251_REG_BOOK(reg) == priv->book;
+}
+
+static const struct regmap_range tas3251_precious_ranges[] = {
+	regmap_reg_range(TAS3251_RESET, TAS3251_RESET),					// never dumped
+};
+
+static const struct regmap_access_table tas3251_precious_table = {
+	.yes_ranges		= tas3251_precious_ranges,
+	.n_yes_ranges		= ARRAY_SIZE(tas3251_precious_ranges),
+};
+
 const struct regmap_config tas3251_regmap_config = {
 	.reg_bits		= 8,
 	.val_bits		= 8,
-	.cache_type		= REGCACHE_NONE,
+	.max_register		= TAS3251_MAX_REGISTER,
+	.ranges			= &tas3251_range,
+	.num_ranges		= 1,
+	.rd_table		= &tas3251_readable_table,
+	.writeable_reg		= tas3251_writeable_reg,
+	.volatile_reg		= tas3251_volatile_reg,
+	.precious_table		= &tas3251_precious_table,
+	.reg_defaults		= tas3251_reg_defaults,
+	.num_reg_defaults	= ARRAY_SIZE(tas3251_reg_defaults),
+	.cache_type		= REGCACHE_MAPLE,
 };
 EXPORT_SYMBOL_GPL(tas3251_regmap_config);
 
+static void tas3251_show_hist(struct seq_file *s, const char *name, const u32 *hist)
+{
+	int i;
+
+	seq_printf(s, "%s latency (us):\n", name);
+	for (i = 0; i < TAS3251_HIST_BINS; i++)
+		if (hist[i])
+			seq_printf(s, "  %9lu: %u\n", i ? 1UL << (i - 1) : 0, hist[i]);
+}
+
+static int tas3251_stats_show(struct seq_file *s, void *data)
+{
+	struct tas3251_private *priv = s->private;
+	struct tas3251_stats *st = &priv->stats;
+	int cfg = priv->active_cfg, i;
+
+	seq_printf(s, "firmware: %s\n", priv->fw_name ? priv->fw_name : "none");
+	seq_printf(s, "rate: %u\n", priv->rate);
+	seq_printf(s, "active config: %d\n", cfg >= 0 ? priv->samplerates[cfg] : 0);
+	seq_printf(s, "downloads: %llu\n", st->downloads);
+	seq_printf(s, "skipped: %llu\n", st->skipped);
+	seq_printf(s, "transactions: %llu\n", st->xfers);
+	seq_printf(s, "bytes: %llu\n", st->bytes);
+	seq_printf(s, "delay ms: %llu\n", st->delay_ms);
+	mutex_lock(&priv->lock);
+	seq_printf(s, "resident: %zu bytes, limit %u KiB\n", tas3251_fw_bytes(priv), fw_cache_kb);
+	for (i = 0; i < priv->num_rates; i++)
+		seq_printf(s, "  %d Hz: %s\n", priv->samplerates[i],
+			   priv->dsp_cfg[i].valid ? "resident" :
+			   priv->fw_present[i] ? "on disk" : "missing");
+	mutex_unlock(&priv->lock);
+	seq_printf(s, "loads: %llu\n", st->loads);
+	seq_printf(s, "evictions: %llu\n", st->evictions);
+	tas3251_show_hist(s, "download", st->download_us);
+	tas3251_show_hist(s, "mute", st->mute_us);
+	tas3251_show_hist(s, "hw_params", st->hw_params_us);
+	seq_printf(s, "resumes: %llu, full restores: %llu\n", st->resumes, st->restores);
+	tas3251_show_hist(s, "resume to first sample", st->resume_us);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tas3251_stats);
+
+static int tas3251_component_probe(struct snd_soc_component *component)
+{
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
+
+	priv->fw_wq = alloc_ordered_workqueue("%s", 0, dev_name(component->dev));
+	if (!priv->fw_wq)
+		return -ENOMEM;
+	INIT_WORK(&priv->fetch_work, tas3251_fetch_work);
+	INIT_WORK(&priv->fw_work, tas3251_fw_work);
+	INIT_DELAYED_WORK(&priv->vol_work, tas3251_vol_work);
+	INIT_DELAYED_WORK(&priv->meter_work, tas3251_meter_work);
+	if (priv->meter_words)
+		snd_soc_add_component_controls(component, &tas3251_meter_control, 1);
+#ifdef CONFIG_DEBUG_FS
+	debugfs_create_file("dsp_stats", 0444, component->debugfs_root, priv,	// per instance
+			    &tas3251_stats_fops);
+#endif
+	tas3251_get_firmware(component);
+	return 0;
+}
+
+static void tas3251_component_remove(struct snd_soc_component *component)
+{
+	struct tas3251_private *priv = snd_soc_component_get_drvdata(component);
+
+	flush_delayed_work(&priv->vol_work);					// last volume lands
+	cancel_delayed_work_sync(&priv->meter_work);
+	destroy_workqueue(priv->fw_wq);						// drains the download
+	wait_for_completion(&priv->fw_done);
+	tas3251_free_firmware(priv);
+}
+
+/* Idle: DSP in standby, register writes are only cached until resume */
+static int tas3251_runtime_suspend(struct device *dev)
+{
+	struct tas3251_private *priv = dev_get_drvdata(dev);
+
+	mutex_lock(&priv->lock);
+	regmap_update_bits(priv->regmap, TAS3251_POWER, TAS3251_RQST, TAS3251_RQST);	// 0x02, 0x10
+	regcache_cache_only(priv->regmap, true);
+	mutex_unlock(&priv->lock);
+	return 0;
+}
+
+/*
+ * Book 0 is synced on every resume, it holds what changed while suspended.
+ * After a possible power loss the cache is marked dirty and the DSP books
+ * are restored from it as well, in bulk and without going back to the
+ * firmware; values still at their defaults are skipped. Both coefficient
+ * buffers are not known to agree then, and the PPC3 power sequence is not
+ * in the cache, so the next stream is a full download. regcache_sync()
+ * only reaches the selected book (see tas3251_writeable_reg()) and clears
+ * the dirty flag once the last book is done.
+ */
+static int tas3251_runtime_resume(struct device *dev)
+{
+	struct tas3251_private *priv = dev_get_drvdata(dev);
+	unsigned int book;
+	int ret = 0;
+
+	priv->resume_start = ktime_get();
+	priv->stats.resumes++;
+	mutex_lock(&priv->lock);
+	regcache_cache_only(priv->regmap, false);
+	if (priv->state_lost) {
+		ret = regmap_write(priv->regmap, TAS3251_PAGE_SEL, 0x00);			// the cached selectors
+		if (!ret)									// may not match the
+			ret = regmap_write(priv->regmap, TAS3251_BOOK_SEL, TAS3251_BOOK_CTRL);	// reset device
+		priv->book = TAS3251_BOOK_CTRL;
+		regcache_mark_dirty(priv->regmap);
+	}
+	if (!ret)
+		ret = regcache_sync(priv->regmap);						// book 0
+	if (!ret)									// the sync moves the
+		ret = regmap_write(priv->regmap, TAS3251_PAGE_SEL, 0x00);			// page, not the cache
+	if (!ret && priv->state_lost) {
+		for_each_set_bit(book, priv->dsp_books, TAS3251_NUM_BOOKS) {
+			ret = tas3251_select_book(priv, book);
+			if (!ret) {
+				regcache_mark_dirty(priv->regmap);				// the last sync
+				ret = regcache_sync(priv->regmap);				// cleared it
+			}
+			if (!ret)							// BOOK_SEL is on
+				ret = regmap_write(priv->regmap, TAS3251_PAGE_SEL, 0x00);	// page 0
+			if (ret)
+				break;
+		}
+		tas3251_select_book(priv, TAS3251_BOOK_CTRL);
+		if (!ret && !bitmap_empty(priv->dsp_books, TAS3251_NUM_BOOKS))
+			ret = tas3251_dsp_swap(priv);
+		priv->active_cfg = -1;
+		priv->previous_rate = 0;
+		priv->stats.restores++;
+	}
+	if (!ret)
+		priv->state_lost = false;
+	mutex_unlock(&priv->lock);
+	if (ret)
+		dev_err(dev, "Failed to restore registers: %d\n", ret);
+	return ret;
+}
+
+/* Supplies may be cut during system sleep */
+static int tas3251_suspend(struct device *dev)
+{
+	struct tas3251_private *priv = dev_get_drvdata(dev);
+
+	priv->state_lost = true;
+	return pm_runtime_force_suspend(dev);
+}
+
+const struct dev_pm_ops tas3251_pm_ops = {
+	SYSTEM_SLEEP_PM_OPS(tas3251_suspend, pm_runtime_force_resume)
+	RUNTIME_PM_OPS(tas3251_runtime_suspend, tas3251_runtime_resume, NULL)
+};
+EXPORT_SYMBOL_GPL(tas3251_pm_ops);
+
 static const struct snd_soc_component_driver soc_component_dev_tas3251 = {
+	.probe			= tas3251_component_probe,
+	.remove			= tas3251_component_remove,
 	.controls		= tas3251_controls,
 	.num_controls		= ARRAY_SIZE(tas3251_controls),
 	.dapm_widgets		= tas3251_dapm_widgets,
 	.num_dapm_widgets	= ARRAY_SIZE(tas3251_dapm_widgets),
 	.dapm_routes		= tas3251_dapm_routes,
 	.num_dapm_routes	= ARRAY_SIZE(tas3251_dapm_routes),
-	.idle_bias_on		= 1,
+	.idle_bias_on		= 0,
 	.use_pmdown_time	= 1,
 	.endianness		= 1,
 };
 
+/* ti,level-meters = <book page reg words>: meter words in one DSP page */
+static void tas3251_parse_meters(struct device *dev, struct tas3251_private *priv)
+{
+	u32 loc[4];
+
+	if (device_property_read_u32_array(dev, "ti,level-meters", loc, ARRAY_SIZE(loc)))
+		return;
+	if ((loc[0] == TAS3251_BOOK_CTRL) || (loc[0] > 0xff) || !loc[1] || (loc[1] > 0xff) ||
+	    !loc[2] || !loc[3] || (loc[3] > TAS3251_MAX_METERS) ||
+	    (loc[2] + 4 * loc[3] > TAS3251_PAGE_LEN)) {
+		dev_err(dev, "Invalid ti,level-meters\n");
+		return;
+	}
+	priv->meter_reg = TAS3251_REG(loc[0], loc[1], loc[2]);
+	priv->meter_words = loc[3];
+}
+
 int tas3251_common_init(struct device *dev, struct regmap *regmap)
 {
 	struct tas3251_private *tas3251;
+	int ret;
 //	int samplerates[4] = {44100, 48000, 88200, 96000};
 	tas3251 = devm_kzalloc(dev, sizeof(struct tas3251_private),
 				GFP_KERNEL);
@@ -437,12 +2150,29 @@ int tas3251_common_init(struct device *dev, struct regmap *regmap)
 		return -ENOMEM;
 
 	tas3251->regmap = regmap;
+	tas3251->book = TAS3251_BOOK_CTRL;
+	tas3251->bclk_ratio = TAS3251_BCLK_RATIO;
+	tas3251->active_cfg = -1;
+	mutex_init(&tas3251->lock);
+	mutex_init(&tas3251->vol_lock);
+	spin_lock_init(&tas3251->meter_lock);
+	tas3251_parse_meters(dev, tas3251);
+	init_completion(&tas3251->fw_done);
+	complete_all(&tas3251->fw_done);						// nothing pending yet
 	dev_set_drvdata(dev, tas3251);
 
 //	tas3251->samplerates = {44100, 48000, 88200, 96000};
 //	tas3251->samplerates[0] = 44100;
 //	*tas3251->samplerates = *samplerates;
 
+	pm_runtime_set_active(dev);
+	pm_runtime_set_autosuspend_delay(dev, TAS3251_AUTOSUSPEND_MS);
+	pm_runtime_mark_last_busy(dev);						// full delay after probe
+	pm_runtime_use_autosuspend(dev);
+	ret = devm_pm_runtime_enable(dev);
+	if (ret)
+		return ret;
+
 	return devm_snd_soc_register_component(dev,
 			&soc_component_dev_tas3251, &tas3251_dai, 1);
 }
@@ -460,9 +2190,11 @@ static int tas3251_i2c_probe(struct i2c_client *client)
 		return ret;
 	}
 
-	regmap_update_bits(regmap, TAS3251_RESET,						// 0x01
-		TAS3251_RSTM | TAS3251_RSTR, TAS3251_RSTM | TAS3251_RSTR);			// 0x10 | 0x01, 0x11
-//		TAS3251_RSTM | TAS3251_RSTR, TAS3251_RSTM | 0);					// 0x10 | 0x01, 0x10
+	regmap_write(regmap, TAS3251_PAGE_SEL, 0x00);						// seed the cached
+	regmap_write(regmap, TAS3251_BOOK_SEL, TAS3251_BOOK_CTRL);				// page and book
+	regmap_write(regmap, TAS3251_RESET,							// 0x01
+		TAS3251_RSTM | TAS3251_RSTR);							// 0x10 | 0x01
+//		TAS3251_RSTM | 0);								// 0x10
 	regmap_update_bits(regmap, TAS3251_MUTE,						// 0x03
 		TAS3251_MUTE_MASK, TAS3251_MUTE_MASK);						// 0x3f
 	regmap_write(regmap, TAS3251_DIG_MUTE_1, 0xbb);						// VNDF, VNDS, VNUF, VNUS
@@ -487,6 +2219,7 @@ static struct i2c_driver tas3251_i2c_driver = {
 	.driver = {
 		.name	= "tas3251",
 		.of_match_table = of_match_ptr(tas3251_of_match),
+		.pm	= pm_ptr(&tas3251_pm_ops),
 	},
 	.id_table	= tas3251_i2c_ids,
 	.probe		= tas3251_i2c_probe,
@@ -498,3 +2231,7 @@ MODULE_DESCRIPTION("ASoC TAS3251 driver");
 MODULE_AUTHOR("Michael Trimarchi <michael@amarulasolutions.com>");
 MODULE_AUTHOR("JP van Coolwijk <jpvc36@gmail.com>");
 MODULE_LICENSE("GPL");
+
+#if IS_ENABLED(CONFIG_SND_SOC_TAS3251_KUNIT_TEST)
+#include "tas3251_test.c"
+#endif
@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * TAS3251 ASoC codec driver, interface for bus glue and machine drivers
+ */
+
+#ifndef _TAS3251_H
+#define _TAS3251_H
+
+#include <linux/pm.h>
+#include <linux/regmap.h>
+#include <linux/types.h>
+
+struct device;
+
+extern const struct regmap_config tas3251_regmap_config;
+extern const struct dev_pm_ops tas3251_pm_ops;
+
+int tas3251_common_init(struct device *dev, struct regmap *regmap);
+int tas3251_write_coeffs(struct device *dev, unsigned int book, unsigned int page,
+			 unsigned int reg, const u8 *data, size_t len);
+
+#endif /* _TAS3251_H */
@@ -0,0 +1,500 @@
+/*
+ * Offline replay of tas3251_*.bin images.
+ *
+ * Replays an image the way tas3251_write_firmware() does: the stream is
+ * compiled like tas3251_compile_firmware() (ascending runs within a page become
+ * one transfer, bursts are register + n - 1 values padded to a pair), page
+ * selects go through the cached regmap page selector and book selects go back
+ * to page 0 first. Reports I2C cost and diffs two images at register level.
+ * With -d the second image is also replayed as a rate switch from the first,
+ * the way tas3251_build_delta() trims it, followed by the buffer swap.
+ *
+ * Budgets (-t, -b) and expected register values (-e) make the exit status
+ * fail, so an image or a change to the write path can be checked in a script.
+ *
+ * A hex -c container is replayed as the config of one of its rates, the base
+ * followed by the rate's delta like the driver does: image.bin:48000, or the
+ * first rate without a suffix. -d c.bin:44100 c.bin:48000 is a rate switch.
+ *
+ * gcc -O2 -o tas3251_sim tas3251_sim.c
+ * ./tas3251_sim [-m max_write] [-w] [-d] [-t max_xfers] [-b max_bytes]
+ *               [-e book:page:reg=val]... image.bin[:rate] [other.bin[:rate]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CFG_META_DELAY		254
+#define CFG_META_BURST		253
+#define CFG_ASCII_TEXT		240
+#define PAGE_SEL		0x00
+#define BOOK_SEL		0x7f
+#define PAGE_LEN		0x80
+#define BOOK_CTRL		0x00
+#define BOOK_DSP		0x8c
+#define SWAP_PAGE		0x23
+#define SWAP_REG		0x14		// 4 bytes, cleared by the DSP
+#define DELTA_GAP		4
+#define MAX_EXPECT		64
+#define REGS			(256 * 256 * PAGE_LEN)
+#define REG(book, page, reg)	((((book) << 8 | (page)) * PAGE_LEN) + (reg))
+#define FW_MAGIC		"TSFW"
+#define FW_HDR_LEN		44		// magic, version, num_rates, name[32], base_len
+#define FW_RATE_LEN		8		// rate, len
+
+struct image {
+    const char *name;
+    unsigned char *data;
+    long len;
+};
+
+struct chip {
+    unsigned char val[REGS];
+    unsigned char written[REGS];
+    unsigned int book, page;
+};
+
+struct cost {
+    unsigned long xfers, bytes, page_switches, book_switches, delay_ms, skipped;
+    unsigned long bits;                                                         // on the wire
+    int written, coeffs;
+};
+
+struct expect {
+    unsigned int reg, val;
+};
+
+static unsigned int max_write;                                                  // 0: unlimited
+static int warm;                                                                // replay twice, report the second
+static int delta;                                                               // replaying a rate switch
+static unsigned long max_xfers, max_bytes;                                      // 0: no budget
+static struct expect expects[MAX_EXPECT];
+static int num_expects;
+
+static unsigned long get_le(const unsigned char *p, int n) {
+    unsigned long v = 0;
+
+    while (n--)
+        v = v << 8 | p[n];
+    return v;
+}
+
+/* Container: keep the base followed by the delta of rate (0: the first rate) */
+static void unpack(struct image *img, unsigned long rate) {
+    const unsigned char *d = img->data;
+    unsigned long n, i, r, len, pos, base;
+    unsigned char *cfg;
+
+    if ((img->len < FW_HDR_LEN) || memcmp(d, FW_MAGIC, 4)) {
+        if (rate) {
+            fprintf(stderr, "%s: not a container, no rate %lu\n", img->name, rate);
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    n = get_le(&d[6], 2);
+    base = get_le(&d[40], 4);
+    pos = FW_HDR_LEN + n * FW_RATE_LEN + base;
+    if (!n || (pos > (unsigned long)img->len))
+        goto malformed;
+    for (i = 0; i < n; i++) {
+        r = get_le(&d[FW_HDR_LEN + i * FW_RATE_LEN], 4);
+        len = get_le(&d[FW_HDR_LEN + i * FW_RATE_LEN + 4], 4);
+        if (len > img->len - pos)
+            goto malformed;
+        if (!rate || (r == rate))
+            break;
+        pos += len;
+    }
+    if (i == n) {
+        fprintf(stderr, "%s: no rate %lu in the container\n", img->name, rate);
+        exit(EXIT_FAILURE);
+    }
+    cfg = malloc(base + len + 1);
+    if (!cfg) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(cfg, &d[FW_HDR_LEN + n * FW_RATE_LEN], base);
+    memcpy(&cfg[base], &d[pos], len);
+    printf("%s: container, %lu rates, %lu Hz: base %lu + delta %lu bytes\n", img->name, n, r,
+           base, len);
+    free(img->data);
+    img->data = cfg;
+    img->len = base + len;
+    return;
+malformed:
+    fprintf(stderr, "%s: container header is malformed\n", img->name);
+    exit(EXIT_FAILURE);
+}
+
+/* name[:rate], the rate picks a config from a container */
+static void load(struct image *img, char *name) {
+    char *colon = strrchr(name, ':'), *end;
+    unsigned long rate = 0;
+    FILE *file;
+
+    if (colon) {
+        rate = strtoul(colon + 1, &end, 10);
+        if (!*end && rate)
+            *colon = 0;
+        else
+            rate = 0;
+    }
+    file = fopen(name, "rb");
+    if (!file) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    fseek(file, 0, SEEK_END);
+    img->len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    img->data = malloc(img->len ? img->len : 1);
+    if (!img->data || fread(img->data, 1, img->len, file) != (size_t)img->len) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    img->name = name;
+    fclose(file);
+    unpack(img, rate);
+    if (colon && rate)
+        *colon = ':';                                                           // name shows the rate
+}
+
+/* One I2C write: address, register, n data bytes, 9 clocks each, plus start and stop */
+static void xfer(struct cost *c, unsigned int n) {
+    c->xfers++;
+    c->bytes += n + 2;
+    c->bits += 9 * (n + 2) + 2;
+}
+
+/* Physical register write, cached like the regmap page and book selectors */
+static void phys_write(struct chip *chip, struct cost *c, unsigned int reg, unsigned int val) {
+    if (reg == PAGE_SEL) {
+        if (chip->page == val)
+            return;
+        chip->page = val;
+        c->page_switches++;
+    } else if ((reg == BOOK_SEL) && (chip->page == 0)) {
+        if (chip->book == val)
+            return;
+        chip->book = val;
+        c->book_switches++;
+    }
+    xfer(c, 1);
+}
+
+static void select_book(struct chip *chip, struct cost *c, unsigned int book) {
+    if (chip->book == book)
+        return;
+    phys_write(chip, c, PAGE_SEL, 0);
+    phys_write(chip, c, BOOK_SEL, book);
+}
+
+static int swap_flag(unsigned int book, unsigned int page, unsigned int reg) {
+    return (book == BOOK_DSP) && (page == SWAP_PAGE) && (reg >= SWAP_REG) && (reg < SWAP_REG + 4);
+}
+
+/* Segments end at the swap flag boundary, like tas3251_swap_split() */
+static unsigned int swap_split(unsigned int book, unsigned int page, unsigned int reg,
+                               unsigned int k) {
+    if ((book != BOOK_DSP) || (page != SWAP_PAGE))
+        return k;
+    if ((reg < SWAP_REG) && (reg + k > SWAP_REG))
+        return SWAP_REG - reg;
+    if (swap_flag(book, page, reg) && (reg + k > SWAP_REG + 4))
+        return SWAP_REG + 4 - reg;
+    return k;
+}
+
+/* Only DSP books are diffed on a rate switch, like tas3251_delta_reg() */
+static int delta_reg(unsigned int book, unsigned int page, unsigned int reg) {
+    return delta && (book != BOOK_CTRL) && !swap_flag(book, page, reg);
+}
+
+/* Send the bytes of a k register segment that differ, bridging short gaps */
+static void write_changed(struct chip *chip, struct cost *c, unsigned int page, unsigned int reg,
+                          const unsigned char *src, unsigned int stride, unsigned int k) {
+    unsigned int i, j, last, vreg = REG(chip->book, page, reg);
+    unsigned char changed[PAGE_LEN];
+
+    for (i = 0; i < k; i++)
+        changed[i] = !chip->written[vreg + i] || (chip->val[vreg + i] != src[i * stride]);
+    for (i = 0; i < k; i = last + 1) {
+        last = i;
+        if (!changed[i])
+            continue;
+        for (j = i + 1; (j < k) && (j <= last + DELTA_GAP); j++)
+            if (changed[j])
+                last = j;
+        phys_write(chip, c, PAGE_SEL, page);
+        xfer(c, last - i + 1);
+        c->written = c->coeffs = 1;
+    }
+}
+
+/* n registers from reg in the current book and the given page, one transfer */
+static void write_block(struct chip *chip, struct cost *c, unsigned int page, unsigned int reg,
+                        const unsigned char *src, unsigned int stride, unsigned int n) {
+    unsigned int i, k, vreg;
+
+    while (n) {
+        k = (max_write && n > max_write) ? max_write : n;
+        k = swap_split(chip->book, page, reg, k);
+        vreg = REG(chip->book, page, reg);
+        if (delta && swap_flag(chip->book, page, reg)) {
+            c->skipped++;                                                       // swapped after the delta
+        } else if (delta_reg(chip->book, page, reg)) {
+            write_changed(chip, c, page, reg, src, stride, k);
+        } else if ((k == 1) && (warm || delta) && chip->written[vreg] && (chip->val[vreg] == *src)) {
+            c->skipped++;                                                       // regmap_update_bits
+        } else {
+            phys_write(chip, c, PAGE_SEL, page);
+            xfer(c, k);
+            c->written = 1;
+            c->coeffs |= (chip->book != BOOK_CTRL);
+        }
+        for (i = 0; i < k; i++) {
+            chip->val[vreg + i] = src[i * stride];
+            chip->written[vreg + i] = 1;
+        }
+        src += k * stride;
+        reg += k;
+        n -= k;
+    }
+}
+
+/* tas3251_dsp_swap(): set the flag, the DSP exchanges the buffers */
+static void swap(struct chip *chip, struct cost *c) {
+    static const unsigned char flag[4] = { 0x00, 0x00, 0x00, 0x01 };
+
+    select_book(chip, c, BOOK_DSP);
+    phys_write(chip, c, PAGE_SEL, SWAP_PAGE);
+    xfer(c, sizeof(flag));
+    select_book(chip, c, BOOK_CTRL);
+}
+
+/* Returns 0, or the offset + 1 of the first malformed record */
+static long replay(const struct image *img, struct chip *chip, struct cost *c) {
+    const unsigned char *data = img->data;
+    unsigned long i = 0, len = img->len;
+    unsigned int page = 0, book = BOOK_CTRL, reg, last, count, stride;
+
+    memset(c, 0, sizeof(*c));
+    while (i < len) {
+        if (i + 2 > len)
+            return i + 1;
+        reg = data[i];
+        last = (page == 0) ? BOOK_SEL - 1 : PAGE_LEN - 1;
+        switch (reg) {
+        case CFG_META_DELAY:
+            if (!delta || c->written)                                           // delta drops idle delays
+                c->delay_ms += data[i + 1];
+            c->written = 0;
+            i += 2;
+            continue;
+        case CFG_ASCII_TEXT:
+            if (!data[i + 1] || (i + data[i + 1] + 1 > len))
+                return i + 1;
+            i += data[i + 1] + 1;
+            continue;
+        case PAGE_SEL:
+            page = data[i + 1];
+            i += 2;
+            continue;
+        case CFG_META_BURST:
+            if ((data[i + 1] < 2) || (i + 2 + data[i + 1] > len))
+                return i + 1;
+            count = data[i + 1] - 1;
+            reg = data[i + 2];
+            if ((reg == PAGE_SEL) || (reg + count - 1 > last))
+                return i + 1;
+            select_book(chip, c, book);
+            write_block(chip, c, page, reg, &data[i + 3], 1, count);
+            i += 2 + ((data[i + 1] + 1) & ~1u);
+            continue;
+        default:
+            if ((reg == BOOK_SEL) && (page == 0)) {
+                book = data[i + 1];
+                i += 2;
+                continue;
+            }
+            if (reg > last)
+                return i + 1;
+            stride = 2;
+            for (count = 1; (i + 2 * count + 1 < len) && (reg + count <= last); count++)
+                if (data[i + 2 * count] != reg + count)
+                    break;
+            select_book(chip, c, book);
+            write_block(chip, c, page, reg, &data[i + 1], stride, count);
+            i += 2 * count;
+            continue;
+        }
+    }
+    select_book(chip, c, BOOK_CTRL);                                            // resting book
+    if (delta && c->coeffs)
+        swap(chip, c);
+    return 0;
+}
+
+/* Replay on chip, or on a fresh chip if NULL */
+static struct chip *run(const struct image *img, struct chip *chip, struct cost *c) {
+    long err;
+
+    if (!chip)
+        chip = calloc(1, sizeof(*chip));
+    if (!chip) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    err = replay(img, chip, c);
+    if (!err && warm && !delta)
+        err = replay(img, chip, c);
+    if (err) {
+        fprintf(stderr, "%s: malformed at offset %ld\n", img->name, err - 1);
+        exit(EXIT_FAILURE);
+    }
+    return chip;
+}
+
+static void report(const char *title, const struct image *img, const struct cost *c) {
+    static const unsigned long khz[] = { 100, 400, 1000 };
+    unsigned int i;
+
+    printf("%s: %ld bytes%s\n", title, img->len, (warm && !delta) ? ", warm cache" : "");
+    printf("  transactions   %lu\n", c->xfers);
+    printf("  bytes on wire  %lu\n", c->bytes);
+    printf("  page switches  %lu\n", c->page_switches);
+    printf("  book switches  %lu\n", c->book_switches);
+    if (warm || delta)
+        printf("  cached writes  %lu\n", c->skipped);
+    printf("  delays         %lu ms\n", c->delay_ms);
+    for (i = 0; i < sizeof(khz) / sizeof(khz[0]); i++)
+        printf("  @%4lu kHz      %.1f ms\n", khz[i], c->bits / (double)khz[i] + c->delay_ms);
+}
+
+static int check_budget(const char *title, const struct cost *c) {
+    int fail = 0;
+
+    if (max_xfers && (c->xfers > max_xfers)) {
+        fprintf(stderr, "FAIL %s: %lu transactions, budget %lu\n", title, c->xfers, max_xfers);
+        fail = 1;
+    }
+    if (max_bytes && (c->bytes > max_bytes)) {
+        fprintf(stderr, "FAIL %s: %lu bytes, budget %lu\n", title, c->bytes, max_bytes);
+        fail = 1;
+    }
+    return fail;
+}
+
+static int check_expects(const char *title, const struct chip *chip) {
+    int i, fail = 0;
+
+    for (i = 0; i < num_expects; i++) {
+        unsigned int r = expects[i].reg;
+        if (!chip->written[r] || (chip->val[r] != expects[i].val)) {
+            fprintf(stderr, "FAIL %s: book 0x%02x page 0x%02x reg 0x%02x ", title,
+                    r / PAGE_LEN >> 8, r / PAGE_LEN & 0xff, r % PAGE_LEN);
+            if (chip->written[r])
+                fprintf(stderr, "is 0x%02x, expected 0x%02x\n", chip->val[r], expects[i].val);
+            else
+                fprintf(stderr, "not written, expected 0x%02x\n", expects[i].val);
+            fail = 1;
+        }
+    }
+    return fail;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-m max_write] [-w] [-d] [-t max_xfers] [-b max_bytes]\n"
+                    "       [-e book:page:reg=val]... image.bin [other.bin]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static void diff(const struct image *a, const struct chip *ca,
+                 const struct image *b, const struct chip *cb) {
+    unsigned long r, n = 0;
+
+    printf("diff %s %s:\n", a->name, b->name);
+    for (r = 0; r < REGS; r++) {
+        if (!ca->written[r] && !cb->written[r])
+            continue;
+        if (ca->written[r] && cb->written[r] && (ca->val[r] == cb->val[r]))
+            continue;
+        printf("  book 0x%02lx page 0x%02lx reg 0x%02lx: ", r / PAGE_LEN >> 8,
+               r / PAGE_LEN & 0xff, r % PAGE_LEN);
+        if (ca->written[r]) printf("0x%02x", ca->val[r]); else printf("  --");
+        printf(" -> ");
+        if (cb->written[r]) printf("0x%02x\n", cb->val[r]); else printf("  --\n");
+        n++;
+    }
+    printf("%lu registers differ\n", n);
+}
+
+int main(int argc, char **argv) {
+    struct image img[2];
+    struct chip *chip[2], *last;
+    struct cost cost;
+    unsigned int book, page, reg, val;
+    int opt, i, n, switch_cost = 0, fail = 0;
+    char title[64];
+
+    while ((opt = getopt(argc, argv, "m:wdt:b:e:")) != -1) {
+        switch (opt) {
+        case 'm':
+            max_write = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            warm = 1;
+            break;
+        case 'd':
+            switch_cost = 1;
+            break;
+        case 't':
+            max_xfers = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            max_bytes = strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            if ((num_expects == MAX_EXPECT) ||
+                (sscanf(optarg, "%i:%i:%i=%i", &book, &page, &reg, &val) != 4) ||
+                (book > 0xff) || (page > 0xff) || (reg >= PAGE_LEN) || (val > 0xff))
+                usage(argv[0]);
+            expects[num_expects].reg = REG(book, page, reg);
+            expects[num_expects++].val = val;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    n = argc - optind;
+    if ((n < 1) || (n > 2) || (switch_cost && (n != 2)))
+        usage(argv[0]);
+
+    for (i = 0; i < n; i++) {
+        load(&img[i], argv[optind + i]);
+        chip[i] = run(&img[i], NULL, &cost);
+        report(img[i].name, &img[i], &cost);
+        fail |= check_budget(img[i].name, &cost);
+    }
+    last = chip[n - 1];
+    if (n == 2)
+        diff(&img[0], chip[0], &img[1], chip[1]);
+
+    if (switch_cost) {
+        snprintf(title, sizeof(title), "switch %s -> %s", img[0].name, img[1].name);
+        delta = 1;
+        last = run(&img[1], chip[0], &cost);                                    // on top of the first
+        report(title, &img[1], &cost);
+        fail |= check_budget(title, &cost);
+    }
+    fail |= check_expects(switch_cost ? title : img[n - 1].name, last);
+
+    for (i = 0; i < n; i++) {
+        free(chip[i]);
+        free(img[i].data);
+    }
+    return fail ? EXIT_FAILURE : 0;
+}
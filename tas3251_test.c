@@ -0,0 +1,795 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * KUnit tests for the TAS3251 codec driver. Built as part of tas3251.c, so
+ * the static helpers can be called directly.
+ *
+ * The regmap runs on a fake bus with a book and page aware register file for
+ * the control port and the DSP book. It counts I2C transactions (reads and
+ * writes) and the register bytes written, so the tests can bound what a rate
+ * switch, mute, format set or volume change puts on the wire.
+ */
+
+#include <kunit/device.h>
+#include <kunit/test.h>
+#include <linux/mman.h>
+
+#define TAS3251_TEST_BOOKS		2		// TAS3251_BOOK_CTRL, TAS3251_BOOK_DSP
+#define TAS3251_TEST_MAX_WRITE		32		// adapter limit, splits long bursts
+#define TAS3251_TEST_SWAP_PAGE		0x23
+#define TAS3251_TEST_SWAP_REG		0x17		// swap bit, cleared by the DSP
+#define TAS3251_TEST_METER_PAGE		0x2c
+
+struct tas3251_test_bus {
+	u8 mem[TAS3251_TEST_BOOKS][256][TAS3251_PAGE_LEN];
+	unsigned int book, page;			// selectors on the chip
+	unsigned int xfers;				// reads and writes
+	unsigned int bytes;				// register bytes written
+	unsigned int swaps;
+	unsigned int stray;				// writes to books not modelled
+};
+
+struct tas3251_test_ctx {
+	struct tas3251_test_bus *bus;
+	struct device *dev;
+	struct snd_soc_component *component;
+	struct snd_soc_dai *dai;
+	struct tas3251_private *priv;
+};
+
+static int tas3251_test_book(unsigned int book)
+{
+	if (book == TAS3251_BOOK_CTRL)
+		return 0;
+	if (book == TAS3251_BOOK_DSP)
+		return 1;
+	return -1;
+}
+
+/* One I2C write: register address, then the values with auto increment */
+static int tas3251_test_write(void *context, const void *data, size_t count)
+{
+	struct tas3251_test_bus *bus = context;
+	const u8 *buf = data;
+	unsigned int reg = buf[0];
+	size_t i;
+	int book;
+
+	bus->xfers++;
+	bus->bytes += count - 1;
+	for (i = 1; i < count; i++, reg++) {
+		if (reg >= TAS3251_PAGE_LEN)
+			return -EIO;
+		if (reg == TAS3251_PAGE_SEL) {
+			bus->page = buf[i];
+			continue;
+		}
+		if (!bus->page && (reg == TAS3251_BOOK_SEL)) {
+			bus->book = buf[i];
+			continue;
+		}
+		book = tas3251_test_book(bus->book);
+		if (book < 0) {
+			bus->stray++;
+			continue;
+		}
+		bus->mem[book][bus->page][reg] = buf[i];
+		if ((bus->book == TAS3251_BOOK_DSP) && (bus->page == TAS3251_TEST_SWAP_PAGE) &&
+		    (reg == TAS3251_TEST_SWAP_REG) && (buf[i] & TAS3251_SWAP)) {
+			bus->mem[book][bus->page][reg] &= ~TAS3251_SWAP;		// swapped at once
+			bus->swaps++;
+		}
+	}
+	return 0;
+}
+
+static int tas3251_test_read(void *context, const void *reg_buf, size_t reg_size,
+			     void *val_buf, size_t val_size)
+{
+	struct tas3251_test_bus *bus = context;
+	unsigned int reg = *(const u8 *)reg_buf;
+	u8 *val = val_buf;
+	size_t i;
+	int book;
+
+	bus->xfers++;
+	for (i = 0; i < val_size; i++, reg++) {
+		book = tas3251_test_book(bus->book);
+		if (reg >= TAS3251_PAGE_LEN)
+			return -EIO;
+		if (reg == TAS3251_PAGE_SEL)
+			val[i] = bus->page;
+		else if (!bus->page && (reg == TAS3251_BOOK_SEL))
+			val[i] = bus->book;
+		else
+			val[i] = (book < 0) ? 0 : bus->mem[book][bus->page][reg];
+	}
+	return 0;
+}
+
+static const struct regmap_bus tas3251_test_regmap_bus = {
+	.write		= tas3251_test_write,
+	.read		= tas3251_test_read,
+	.max_raw_write	= TAS3251_TEST_MAX_WRITE,
+};
+
+static u8 tas3251_test_reg(struct tas3251_test_bus *bus, unsigned int book,
+			   unsigned int page, unsigned int reg)
+{
+	return bus->mem[tas3251_test_book(book)][page][reg];
+}
+
+static void tas3251_test_reset(struct tas3251_test_bus *bus)
+{
+	bus->xfers = 0;
+	bus->bytes = 0;
+	bus->swaps = 0;
+}
+
+/* The register file as the chip comes out of a reset or a power cycle */
+static void tas3251_test_power_on(struct tas3251_test_bus *bus)
+{
+	unsigned int i, reg;
+
+	memset(bus->mem, 0, sizeof(bus->mem));
+	bus->book = TAS3251_BOOK_CTRL;
+	bus->page = 0;
+	for (i = 0; i < ARRAY_SIZE(tas3251_reg_defaults); i++) {
+		reg = tas3251_reg_defaults[i].reg - TAS3251_REG(TAS3251_BOOK_CTRL, 0x00, 0x00);
+		bus->mem[0][0][reg] = tas3251_reg_defaults[i].def;
+	}
+}
+
+static struct snd_kcontrol *tas3251_test_kcontrol(struct kunit *test)
+{
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct snd_kcontrol *kcontrol;
+
+	kcontrol = kunit_kzalloc(test, sizeof(*kcontrol), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, kcontrol);
+	kcontrol->private_data = ctx->component;
+	return kcontrol;
+}
+
+/* 16 coefficient bytes from v, as one PPC3 burst at register 0x08 of page p */
+#define TAS3251_TEST_BURST(p, v)	0x00, (p), CFG_META_BURST, 17, 0x08,	\
+	(v) + 0, (v) + 1, (v) + 2, (v) + 3, (v) + 4, (v) + 5, (v) + 6, (v) + 7,	\
+	(v) + 8, (v) + 9, (v) + 10, (v) + 11, (v) + 12, (v) + 13, (v) + 14,	\
+	(v) + 15, 0x00
+#define TAS3251_TEST_SWAP		0x00, TAS3251_TEST_SWAP_PAGE,		\
+	0x14, 0x00, 0x15, 0x00, 0x16, 0x00, TAS3251_TEST_SWAP_REG, TAS3251_SWAP
+
+/* Shared part: four pages of coefficients and two single writes */
+static const u8 tas3251_test_base[] = {
+	CFG_ASCII_TEXT, 5, 'b', 'a', 's', 'e',
+	0x00, 0x00, TAS3251_BOOK_SEL, TAS3251_BOOK_DSP,
+	TAS3251_TEST_BURST(0x1c, 0x10),
+	TAS3251_TEST_BURST(0x1d, 0x20),
+	TAS3251_TEST_BURST(0x1e, 0x30),
+	TAS3251_TEST_BURST(0x1f, 0x40),
+	0x50, 0xaa, 0x51, 0xab,
+	0x00, 0x00, TAS3251_BOOK_SEL, TAS3251_BOOK_CTRL,
+};
+
+static const u8 tas3251_test_44k1[] = {
+	0x00, 0x00, TAS3251_BOOK_SEL, TAS3251_BOOK_DSP,
+	0x00, 0x20, 0x08, 0x44, 0x09, 0x44, 0x0a, 0x44, 0x0b, 0x44,
+	0x0c, 0x44, 0x0d, 0x44, 0x0e, 0x44, 0x0f, 0x44,
+	TAS3251_TEST_SWAP,
+	0x00, 0x00, TAS3251_BOOK_SEL, TAS3251_BOOK_CTRL,
+};
+
+/* Differs from 44.1 kHz in one byte of page 0x20 and one of page 0x21 */
+static const u8 tas3251_test_48k[] = {
+	0x00, 0x00, TAS3251_BOOK_SEL, TAS3251_BOOK_DSP,
+	0x00, 0x20, 0x08, 0x44, 0x09, 0x44, 0x0a, 0x44, 0x0b, 0x44,
+	0x0c, 0x44, 0x0d, 0x44, 0x0e, 0x44, 0x0f, 0x48,
+	0x00, 0x21, 0x08, 0x48,
+	TAS3251_TEST_SWAP,
+	0x00, 0x00, TAS3251_BOOK_SEL, TAS3251_BOOK_CTRL,
+};
+
+static const struct {
+	unsigned int rate;
+	const u8 *data;
+	size_t len;
+} tas3251_test_rates[] = {
+	{ 44100, tas3251_test_44k1, sizeof(tas3251_test_44k1) },
+	{ 48000, tas3251_test_48k, sizeof(tas3251_test_48k) },
+};
+
+/* A container as hex -c writes it */
+static u8 *tas3251_test_container(struct kunit *test, size_t *size)
+{
+	unsigned int i, n = ARRAY_SIZE(tas3251_test_rates);
+	struct tas3251_fw_hdr *hdr;
+	struct tas3251_fw_rate *ent;
+	u8 *buf, *pos;
+
+	*size = sizeof(*hdr) + n * sizeof(*ent) + sizeof(tas3251_test_base);
+	for (i = 0; i < n; i++)
+		*size += tas3251_test_rates[i].len;
+	buf = kunit_kzalloc(test, *size, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, buf);
+
+	hdr = (void *)buf;
+	hdr->magic = cpu_to_le32(TAS3251_FW_MAGIC);
+	hdr->version = cpu_to_le16(TAS3251_FW_VERSION);
+	hdr->num_rates = cpu_to_le16(n);
+	strscpy(hdr->name, "kunit", sizeof(hdr->name));
+	hdr->base_len = cpu_to_le32(sizeof(tas3251_test_base));
+	ent = (void *)(hdr + 1);
+	pos = (u8 *)(ent + n);
+	memcpy(pos, tas3251_test_base, sizeof(tas3251_test_base));
+	pos += sizeof(tas3251_test_base);
+	for (i = 0; i < n; i++) {
+		ent[i].rate = cpu_to_le32(tas3251_test_rates[i].rate);
+		ent[i].len = cpu_to_le32(tas3251_test_rates[i].len);
+		memcpy(pos, tas3251_test_rates[i].data, tas3251_test_rates[i].len);
+		pos += tas3251_test_rates[i].len;
+	}
+	return buf;
+}
+
+static int tas3251_test_load(struct kunit *test, const u8 *data, size_t size)
+{
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct tas3251_private *priv = ctx->priv;
+	struct firmware fw = { .data = data, .size = size };
+	int ret;
+
+	mutex_lock(&priv->lock);
+	tas3251_free_firmware(priv);
+	ret = tas3251_load_container(priv, &fw);
+	mutex_unlock(&priv->lock);
+	return ret;
+}
+
+/* hw_params and prepare, so the download has finished on return */
+static int tas3251_test_hw_params(struct kunit *test, unsigned int rate)
+{
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct snd_pcm_hw_params *params;
+	struct snd_interval *interval;
+	int ret;
+
+	params = kunit_kzalloc(test, sizeof(*params), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, params);
+	snd_mask_set_format(hw_param_mask(params, SNDRV_PCM_HW_PARAM_FORMAT),
+			    SNDRV_PCM_FORMAT_S32_LE);
+	interval = hw_param_interval(params, SNDRV_PCM_HW_PARAM_RATE);
+	interval->min = rate;
+	interval->max = rate;
+	interval->integer = 1;
+	ret = tas3251_hw_params(NULL, params, ctx->dai);
+	tas3251_prepare(NULL, ctx->dai);
+	return ret;
+}
+
+/* As tas3251_i2c_probe(), then the component probe a card would run */
+static int tas3251_test_init(struct kunit *test)
+{
+	struct tas3251_test_ctx *ctx;
+	struct regmap *regmap;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx);
+	ctx->bus = kunit_kzalloc(test, sizeof(*ctx->bus), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->bus);
+	test->priv = ctx;
+	tas3251_test_power_on(ctx->bus);					// after the reset
+
+	ctx->dev = kunit_device_register(test, "tas3251-test");
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, ctx->dev);
+	pm_runtime_no_callbacks(ctx->dev);
+	regmap = devm_regmap_init(ctx->dev, &tas3251_test_regmap_bus, ctx->bus,
+				  &tas3251_regmap_config);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, regmap);
+	KUNIT_ASSERT_EQ(test, regmap_write(regmap, TAS3251_PAGE_SEL, 0x00), 0);
+	KUNIT_ASSERT_EQ(test, regmap_write(regmap, TAS3251_BOOK_SEL, TAS3251_BOOK_CTRL), 0);
+	KUNIT_ASSERT_EQ(test, tas3251_common_init(ctx->dev, regmap), 0);
+
+	ctx->component = snd_soc_lookup_component(ctx->dev, NULL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->component);
+	ctx->dai = list_first_entry_or_null(&ctx->component->dai_list, struct snd_soc_dai, list);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->dai);
+	ctx->priv = snd_soc_component_get_drvdata(ctx->component);
+#ifdef CONFIG_DEBUG_FS
+	ctx->component->debugfs_root = debugfs_create_dir(dev_name(ctx->dev), NULL);
+#endif
+	KUNIT_ASSERT_EQ(test, tas3251_component_probe(ctx->component), 0);
+	wait_for_completion(&ctx->priv->fw_done);				// no files here
+	return 0;
+}
+
+static void tas3251_test_exit(struct kunit *test)
+{
+	struct tas3251_test_ctx *ctx = test->priv;
+
+	if (!ctx || !ctx->priv || !ctx->priv->fw_wq)
+		return;
+	tas3251_component_remove(ctx->component);
+#ifdef CONFIG_DEBUG_FS
+	debugfs_remove_recursive(ctx->component->debugfs_root);
+#endif
+}
+
+/* Ascending writes merge into one bulk, a long burst splits at the write limit */
+static void tas3251_test_compile_accept(struct kunit *test)
+{
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct tas3251_fw_cfg cfg = { };
+	u8 data[48];
+	unsigned int i;
+
+	data[0] = TAS3251_BOOK_SEL;
+	data[1] = TAS3251_BOOK_DSP;
+	data[2] = TAS3251_PAGE_SEL;
+	data[3] = 0x1e;
+	data[4] = CFG_META_BURST;
+	data[5] = 41;								// reg + 40 values
+	data[6] = 0x08;
+	for (i = 0; i < 40; i++)
+		data[7 + i] = i;
+	data[47] = 0x00;							// pad
+	KUNIT_ASSERT_EQ(test, tas3251_compile_firmware(ctx->priv, data, sizeof(data), &cfg), 0);
+	KUNIT_ASSERT_EQ(test, cfg.num_ops, 2);
+	KUNIT_EXPECT_EQ(test, cfg.ops[0].type, TAS3251_FW_BULK);
+	KUNIT_EXPECT_EQ(test, cfg.ops[0].reg, TAS3251_REG(TAS3251_BOOK_DSP, 0x1e, 0x08));
+	KUNIT_EXPECT_EQ(test, cfg.ops[0].len, TAS3251_TEST_MAX_WRITE);
+	KUNIT_EXPECT_EQ(test, cfg.ops[1].reg, TAS3251_REG(TAS3251_BOOK_DSP, 0x1e, 0x28));
+	KUNIT_EXPECT_EQ(test, cfg.ops[1].len, 40 - TAS3251_TEST_MAX_WRITE);
+	KUNIT_EXPECT_EQ(test, cfg.vals[cfg.ops[1].val], TAS3251_TEST_MAX_WRITE);
+	tas3251_free_cfg(&cfg);
+
+	KUNIT_ASSERT_EQ(test, tas3251_compile_firmware(ctx->priv, tas3251_test_48k,
+						       sizeof(tas3251_test_48k), &cfg), 0);
+	KUNIT_ASSERT_EQ(test, cfg.num_ops, 3);					// page 0x20, 0x21, swap
+	KUNIT_EXPECT_EQ(test, cfg.ops[0].type, TAS3251_FW_BULK);
+	KUNIT_EXPECT_EQ(test, cfg.ops[0].len, 8);
+	KUNIT_EXPECT_EQ(test, cfg.ops[1].type, TAS3251_FW_WRITE);
+	KUNIT_EXPECT_TRUE(test, tas3251_swap_op(&cfg, &cfg.ops[2]));
+	tas3251_free_cfg(&cfg);
+
+	/* A run over the swap flag splits there, the flag words stay the swap */
+	data[2] = TAS3251_PAGE_SEL;
+	data[3] = TAS3251_TEST_SWAP_PAGE;
+	for (i = 0; i < 8; i++) {
+		data[4 + 2 * i] = 0x10 + i;
+		data[5 + 2 * i] = (i == 7) ? TAS3251_SWAP : 0x00;
+	}
+	KUNIT_ASSERT_EQ(test, tas3251_compile_firmware(ctx->priv, data, 20, &cfg), 0);
+	KUNIT_ASSERT_EQ(test, cfg.num_ops, 2);
+	KUNIT_EXPECT_EQ(test, cfg.ops[0].len, 4);
+	KUNIT_EXPECT_FALSE(test, tas3251_swap_op(&cfg, &cfg.ops[0]));
+	KUNIT_EXPECT_EQ(test, cfg.ops[1].reg, TAS3251_DSP_SWAP_FLAG);
+	KUNIT_EXPECT_TRUE(test, tas3251_swap_op(&cfg, &cfg.ops[1]));
+	tas3251_free_cfg(&cfg);
+}
+
+static void tas3251_test_compile_reject(struct kunit *test)
+{
+	static const u8 text_empty[] = { CFG_ASCII_TEXT, 0x00, 0x08, 0x00 };
+	static const u8 text_overrun[] = { CFG_ASCII_TEXT, 0x09, 'a', 'b' };
+	static const u8 burst_overrun[] = { CFG_META_BURST, 0x09, 0x08, 0x01, 0x02, 0x00 };
+	static const u8 burst_page_end[] = { 0x00, 0x1e, CFG_META_BURST, 0x04, 0x7e, 0x01, 0x02, 0x03 };
+	static const u8 burst_page_sel[] = { CFG_META_BURST, 0x03, 0x00, 0x01, 0x02, 0x00 };
+	static const u8 odd[] = { 0x08, 0x01, 0x09 };
+	static const struct {
+		const char *name;
+		const u8 *data;
+		unsigned int len;
+	} cases[] = {
+		{ "empty text", text_empty, sizeof(text_empty) },
+		{ "text overrun", text_overrun, sizeof(text_overrun) },
+		{ "burst overrun", burst_overrun, sizeof(burst_overrun) },
+		{ "burst past the page", burst_page_end, sizeof(burst_page_end) },
+		{ "burst into the page select", burst_page_sel, sizeof(burst_page_sel) },
+		{ "odd length", odd, sizeof(odd) },
+	};
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct tas3251_fw_cfg cfg = { };
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cases); i++) {
+		KUNIT_EXPECT_EQ_MSG(test, tas3251_compile_firmware(ctx->priv, cases[i].data,
+								   cases[i].len, &cfg),
+				    -EINVAL, "%s", cases[i].name);
+		KUNIT_EXPECT_FALSE_MSG(test, cfg.valid, "%s", cases[i].name);
+	}
+}
+
+static void tas3251_test_container_reject(struct kunit *test)
+{
+	struct tas3251_fw_hdr *hdr;
+	struct tas3251_fw_rate *ent;
+	size_t size;
+	u8 *buf;
+
+	buf = tas3251_test_container(test, &size);
+	hdr = (void *)buf;
+	ent = (void *)(hdr + 1);
+	KUNIT_EXPECT_EQ(test, tas3251_test_load(test, buf, size - 1), -EINVAL);	// truncated
+	ent[1].len = cpu_to_le32(le32_to_cpu(ent[1].len) + 2);
+	KUNIT_EXPECT_EQ(test, tas3251_test_load(test, buf, size), -EINVAL);
+	hdr->version = cpu_to_le16(TAS3251_FW_VERSION + 1);
+	KUNIT_EXPECT_EQ(test, tas3251_test_load(test, buf, size), -EINVAL);
+	hdr->magic = 0;
+	KUNIT_EXPECT_EQ(test, tas3251_test_load(test, buf, size), -ENOENT);
+}
+
+/* First download of a rate: base and rate part in full, one swap, back in book 0 */
+static void tas3251_test_full_download(struct kunit *test)
+{
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct tas3251_test_bus *bus = ctx->bus;
+	unsigned int i;
+	size_t size;
+	u8 *buf;
+
+	buf = tas3251_test_container(test, &size);
+	KUNIT_ASSERT_EQ(test, tas3251_test_load(test, buf, size), 0);
+	KUNIT_ASSERT_EQ(test, ctx->priv->num_rates, ARRAY_SIZE(tas3251_test_rates));
+	tas3251_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, tas3251_test_hw_params(test, 44100), 0);
+
+	KUNIT_EXPECT_EQ(test, ctx->priv->active_cfg, 0);
+	KUNIT_EXPECT_EQ(test, ctx->priv->stats.downloads, 1);
+	for (i = 0; i < 16; i++) {
+		KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x1c, 0x08 + i), 0x10 + i);
+		KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x1f, 0x08 + i), 0x40 + i);
+	}
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x1f, 0x50), 0xaa);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x1f, 0x51), 0xab);
+	for (i = 0; i < 8; i++)
+		KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x20, 0x08 + i), 0x44);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x21, 0x08), 0x00);
+	KUNIT_EXPECT_EQ(test, bus->swaps, 1);
+	KUNIT_EXPECT_EQ(test, bus->book, TAS3251_BOOK_CTRL);
+	KUNIT_EXPECT_EQ(test, bus->page, 0);
+	KUNIT_EXPECT_EQ(test, bus->stray, 0);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_CTRL, 0x00, 0x28) & TAS3251_ALEN,
+			0x03);								// 32 bit
+}
+
+/*
+ * 44.1 -> 48 kHz: the two changed bytes and the swap. Book select, page and
+ * byte for 0x20, page, read and byte for the uncached 0x21, page and book 0,
+ * then the swap: book, page, flag, poll, page and book 0.
+ */
+#define TAS3251_TEST_SWITCH_XFERS	14
+
+static void tas3251_test_rate_switch(struct kunit *test)
+{
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct tas3251_test_bus *bus = ctx->bus;
+	unsigned int xfers, bytes;
+	size_t size;
+	u8 *buf;
+
+	buf = tas3251_test_container(test, &size);
+	KUNIT_ASSERT_EQ(test, tas3251_test_load(test, buf, size), 0);
+	KUNIT_ASSERT_EQ(test, tas3251_test_hw_params(test, 44100), 0);
+
+	tas3251_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, tas3251_test_hw_params(test, 48000), 0);
+	xfers = bus->xfers;
+	bytes = bus->bytes;
+	KUNIT_EXPECT_EQ(test, ctx->priv->active_cfg, 1);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x20, 0x0e), 0x44);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x20, 0x0f), 0x48);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x21, 0x08), 0x48);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x1e, 0x08), 0x30);
+	KUNIT_EXPECT_EQ(test, bus->swaps, 1);
+	KUNIT_EXPECT_EQ(test, bus->book, TAS3251_BOOK_CTRL);
+	KUNIT_EXPECT_EQ(test, bus->page, 0);
+	KUNIT_EXPECT_LE(test, xfers, TAS3251_TEST_SWITCH_XFERS);
+
+	/* The same switch back as a full download, the delta must beat it */
+	mutex_lock(&ctx->priv->lock);
+	ctx->priv->active_cfg = -1;
+	mutex_unlock(&ctx->priv->lock);
+	tas3251_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, tas3251_test_hw_params(test, 44100), 0);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x20, 0x0f), 0x44);
+	KUNIT_EXPECT_EQ(test, bus->swaps, 1);
+	KUNIT_EXPECT_LT(test, xfers, bus->xfers);
+	KUNIT_EXPECT_LT(test, bytes, bus->bytes);
+	KUNIT_EXPECT_EQ(test, bus->stray, 0);
+}
+
+/* Once the registers are cached, mute and unmute are two writes each */
+static void tas3251_test_mute(struct kunit *test)
+{
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct tas3251_test_bus *bus = ctx->bus;
+	size_t size;
+	u8 *buf;
+
+	buf = tas3251_test_container(test, &size);
+	KUNIT_ASSERT_EQ(test, tas3251_test_load(test, buf, size), 0);
+	KUNIT_ASSERT_EQ(test, tas3251_test_hw_params(test, 44100), 0);
+	KUNIT_ASSERT_EQ(test, tas3251_mute(ctx->dai, 0, SNDRV_PCM_STREAM_PLAYBACK), 0);
+	KUNIT_ASSERT_EQ(test, tas3251_mute(ctx->dai, 1, SNDRV_PCM_STREAM_PLAYBACK), 0);
+
+	tas3251_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, tas3251_mute(ctx->dai, 0, SNDRV_PCM_STREAM_PLAYBACK), 0);
+	KUNIT_EXPECT_LE(test, bus->xfers, 2);
+	KUNIT_EXPECT_LE(test, bus->bytes, 2);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_CTRL, 0x00, 0x03) &
+			TAS3251_MUTE_MASK, 0);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_CTRL, 0x00, 0x02) &
+			(TAS3251_DSPR | TAS3251_RQST), 0);
+
+	tas3251_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, tas3251_mute(ctx->dai, 1, SNDRV_PCM_STREAM_PLAYBACK), 0);
+	KUNIT_EXPECT_LE(test, bus->xfers, 2);
+	KUNIT_EXPECT_LE(test, bus->bytes, 2);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_CTRL, 0x00, 0x03) &
+			TAS3251_MUTE_MASK, TAS3251_MUTE_MASK);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_CTRL, 0x00, 0x02) &
+			(TAS3251_DSPR | TAS3251_RQST), TAS3251_DSPR | TAS3251_RQST);
+	KUNIT_EXPECT_EQ(test, bus->swaps, 0);
+}
+
+/*
+ * A format set at the default rate does not download: only the data offset
+ * write, which is not an update, reaches the chip.
+ */
+static void tas3251_test_format(struct kunit *test)
+{
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct tas3251_test_bus *bus = ctx->bus;
+	unsigned int fmt = SND_SOC_DAIFMT_I2S | SND_SOC_DAIFMT_NB_NF | SND_SOC_DAIFMT_CBC_CFC;
+	u64 downloads;
+	size_t size;
+	u8 *buf;
+
+	buf = tas3251_test_container(test, &size);
+	KUNIT_ASSERT_EQ(test, tas3251_test_load(test, buf, size), 0);
+	KUNIT_ASSERT_EQ(test, tas3251_test_hw_params(test, DEFAULT_RATE), 0);
+	KUNIT_ASSERT_EQ(test, tas3251_set_dai_fmt(ctx->dai, fmt), 0);
+	tas3251_prepare(NULL, ctx->dai);
+
+	downloads = ctx->priv->stats.downloads;
+	tas3251_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, tas3251_set_dai_fmt(ctx->dai, fmt), 0);
+	tas3251_prepare(NULL, ctx->dai);
+	KUNIT_EXPECT_LE(test, bus->xfers, 2);
+	KUNIT_EXPECT_LE(test, bus->bytes, 2);
+	KUNIT_EXPECT_EQ(test, ctx->priv->stats.downloads, downloads);
+	KUNIT_EXPECT_EQ(test, bus->swaps, 0);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_CTRL, 0x00, 0x28) & TAS3251_AFMT, 0);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_CTRL, 0x00, 0x29), 0);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_CTRL, 0x00, 0x04) & TAS3251_PLLE,
+			TAS3251_PLLE);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_CTRL, 0x00, 0x0d) &
+			TAS3251_PLL_DSP_REF_MASK, TAS3251_SREF_SCLK);
+}
+
+/* A slider drag: five puts, one left/right transfer */
+static void tas3251_test_volume(struct kunit *test)
+{
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct tas3251_test_bus *bus = ctx->bus;
+	struct soc_mixer_control mc = { .max = 255 };
+	struct snd_ctl_elem_value *ucontrol;
+	struct snd_kcontrol *kcontrol;
+	unsigned int i;
+
+	kcontrol = tas3251_test_kcontrol(test);
+	ucontrol = kunit_kzalloc(test, sizeof(*ucontrol), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ucontrol);
+	kcontrol->private_value = (unsigned long)&mc;
+
+	tas3251_test_reset(bus);
+	for (i = 0; i < 5; i++) {
+		ucontrol->value.integer.value[0] = 200 - i;
+		ucontrol->value.integer.value[1] = 190 - i;
+		KUNIT_EXPECT_EQ(test, tas3251_vol_put(kcontrol, ucontrol), 1);
+	}
+	flush_delayed_work(&ctx->priv->vol_work);
+	KUNIT_EXPECT_LE(test, bus->xfers, 2);
+	KUNIT_EXPECT_LE(test, bus->bytes, 4);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_CTRL, 0x00, 0x3d), 255 - 196);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_CTRL, 0x00, 0x3e), 255 - 186);
+
+	tas3251_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, tas3251_vol_get(kcontrol, ucontrol), 0);
+	KUNIT_EXPECT_EQ(test, ucontrol->value.integer.value[0], 196);
+	KUNIT_EXPECT_EQ(test, ucontrol->value.integer.value[1], 186);
+	KUNIT_EXPECT_EQ(test, bus->xfers, 0);					// cached
+	KUNIT_EXPECT_EQ(test, tas3251_vol_put(kcontrol, ucontrol), 0);		// unchanged
+}
+
+/*
+ * System sleep with the supplies cut: the chip comes back in its reset state,
+ * the resume writes book 0 and the DSP books back from the cache and swaps
+ * the restored coefficients in. The next stream is a full download.
+ */
+static void tas3251_test_state_lost(struct kunit *test)
+{
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct tas3251_test_bus *bus = ctx->bus;
+	struct tas3251_private *priv = ctx->priv;
+	u8 (*saved)[256][TAS3251_PAGE_LEN];
+	unsigned int book, page;
+	u64 downloads;
+	size_t size;
+	u8 *buf;
+
+	saved = kunit_kzalloc(test, sizeof(bus->mem), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, saved);
+	buf = tas3251_test_container(test, &size);
+	KUNIT_ASSERT_EQ(test, tas3251_test_load(test, buf, size), 0);
+	KUNIT_ASSERT_EQ(test, tas3251_test_hw_params(test, 44100), 0);
+	KUNIT_ASSERT_EQ(test, tas3251_mute(ctx->dai, 0, SNDRV_PCM_STREAM_PLAYBACK), 0);
+	KUNIT_ASSERT_EQ(test, tas3251_mute(ctx->dai, 1, SNDRV_PCM_STREAM_PLAYBACK), 0);
+
+	KUNIT_ASSERT_EQ(test, tas3251_runtime_suspend(ctx->dev), 0);		// autosuspend
+	KUNIT_ASSERT_EQ(test, tas3251_suspend(ctx->dev), 0);			// then system sleep
+	memcpy(saved, bus->mem, sizeof(bus->mem));
+	tas3251_test_power_on(bus);
+	tas3251_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, pm_runtime_force_resume(ctx->dev), 0);
+	KUNIT_ASSERT_EQ(test, tas3251_runtime_resume(ctx->dev), 0);		// first use
+
+	for (book = 0; book < TAS3251_TEST_BOOKS; book++)
+		for (page = 0; page < 256; page++)
+			KUNIT_EXPECT_MEMEQ_MSG(test, bus->mem[book][page], saved[book][page],
+					       TAS3251_PAGE_LEN, "book %u page 0x%02x", book, page);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x1c, 0x08), 0x10);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x20, 0x08), 0x44);
+	KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_CTRL, 0x00, 0x03), TAS3251_MUTE_MASK);
+	KUNIT_EXPECT_EQ(test, bus->swaps, 1);
+	KUNIT_EXPECT_EQ(test, bus->book, TAS3251_BOOK_CTRL);
+	KUNIT_EXPECT_EQ(test, bus->page, 0);
+	KUNIT_EXPECT_EQ(test, bus->stray, 0);
+	KUNIT_EXPECT_FALSE(test, priv->state_lost);
+	KUNIT_EXPECT_EQ(test, priv->previous_rate, 0);
+	KUNIT_EXPECT_EQ(test, priv->active_cfg, -1);
+	KUNIT_EXPECT_EQ(test, priv->stats.restores, 1);
+
+	/* With the cache clean again, a plain runtime resume only puts the page back */
+	KUNIT_ASSERT_EQ(test, tas3251_runtime_suspend(ctx->dev), 0);
+	tas3251_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, tas3251_runtime_resume(ctx->dev), 0);
+	KUNIT_EXPECT_LE(test, bus->xfers, 2);
+	KUNIT_EXPECT_EQ(test, priv->stats.restores, 1);
+
+	downloads = priv->stats.downloads;
+	tas3251_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, tas3251_test_hw_params(test, 44100), 0);
+	KUNIT_EXPECT_EQ(test, priv->stats.downloads, downloads + 1);
+	KUNIT_EXPECT_EQ(test, priv->active_cfg, 0);
+	KUNIT_EXPECT_EQ(test, bus->swaps, 1);
+}
+
+/* Both meter words in one bulk read per refresh; unused, the meters read 0 */
+static void tas3251_test_meter(struct kunit *test)
+{
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct tas3251_test_bus *bus = ctx->bus;
+	struct tas3251_private *priv = ctx->priv;
+	u8 *words = &bus->mem[1][TAS3251_TEST_METER_PAGE][0x08];
+	struct snd_ctl_elem_value *ucontrol;
+	struct snd_kcontrol *kcontrol;
+
+	kcontrol = tas3251_test_kcontrol(test);
+	ucontrol = kunit_kzalloc(test, sizeof(*ucontrol), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ucontrol);
+	mutex_lock(&priv->lock);						// as ti,level-meters
+	priv->meter_reg = TAS3251_REG(TAS3251_BOOK_DSP, TAS3251_TEST_METER_PAGE, 0x08);
+	priv->meter_words = 2;
+	mutex_unlock(&priv->lock);
+	put_unaligned_be32(0x00123456, &words[0]);
+	put_unaligned_be32(0xfff00000, &words[4]);
+
+	KUNIT_ASSERT_EQ(test, pm_runtime_resume_and_get(ctx->dev), 0);	// a stream is open
+	tas3251_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, tas3251_meter_get(kcontrol, ucontrol), 0);	// starts the work
+	flush_delayed_work(&priv->meter_work);
+	KUNIT_ASSERT_EQ(test, tas3251_meter_get(kcontrol, ucontrol), 0);
+	KUNIT_EXPECT_EQ(test, ucontrol->value.integer.value[0], 0x123456);
+	KUNIT_EXPECT_EQ(test, ucontrol->value.integer.value[1], -0x100000);
+	KUNIT_EXPECT_LE(test, bus->xfers, 5);					// book, page, read,
+	KUNIT_EXPECT_EQ(test, bus->book, TAS3251_BOOK_CTRL);			// page and book 0
+	KUNIT_EXPECT_EQ(test, bus->page, 0);
+
+	put_unaligned_be32(0x00000042, &words[4]);				// not cached
+	flush_delayed_work(&priv->meter_work);
+	KUNIT_ASSERT_EQ(test, tas3251_meter_get(kcontrol, ucontrol), 0);
+	KUNIT_EXPECT_EQ(test, ucontrol->value.integer.value[1], 0x42);
+
+	pm_runtime_put_noidle(ctx->dev);
+	tas3251_test_reset(bus);
+	flush_delayed_work(&priv->meter_work);
+	KUNIT_ASSERT_EQ(test, tas3251_meter_get(kcontrol, ucontrol), 0);
+	KUNIT_EXPECT_EQ(test, ucontrol->value.integer.value[0], 0);
+	KUNIT_EXPECT_EQ(test, ucontrol->value.integer.value[1], 0);
+	KUNIT_EXPECT_EQ(test, bus->xfers, 0);
+}
+
+/* Puts an upload into user memory, as the TLV ioctl passes it on */
+static int tas3251_test_coeffs_put(struct kunit *test, const u8 *data, unsigned int len)
+{
+	struct snd_ctl_tlv *tlv;
+	unsigned long user;
+
+	tlv = kunit_kzalloc(test, sizeof(*tlv) + len, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, tlv);
+	tlv->length = len;
+	memcpy(tlv->tlv, data, len);
+	user = kunit_vm_mmap(test, NULL, 0, PAGE_SIZE, PROT_READ | PROT_WRITE,
+			     MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	KUNIT_ASSERT_NE_MSG(test, user, 0, "no user memory");
+	KUNIT_ASSERT_FALSE(test, IS_ERR_VALUE(user));
+	KUNIT_ASSERT_EQ(test, copy_to_user((void __user *)user, tlv, sizeof(*tlv) + len), 0);
+	return tas3251_coeffs_put(tas3251_test_kcontrol(test), (const unsigned int __user *)user,
+				  sizeof(*tlv) + len);
+}
+
+/* Each block is one transfer into its DSP page, one swap at the end */
+static void tas3251_test_coeffs(struct kunit *test)
+{
+	static const u8 upload[] = {
+		TAS3251_COEFF_SWAP, 0x00, 0x00, 0x00,
+		TAS3251_BOOK_DSP, 0x1c, 0x08, 8, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+		TAS3251_BOOK_DSP, 0x30, 0x7c, 4, 0xa1, 0xa2, 0xa3, 0xa4,
+	};
+	static const u8 book_ctrl[] = {
+		0x00, 0x00, 0x00, 0x00, TAS3251_BOOK_CTRL, 0x01, 0x08, 1, 0x55,
+	};
+	static const u8 page_end[] = {
+		0x00, 0x00, 0x00, 0x00, TAS3251_BOOK_DSP, 0x1c, 0x7e, 4, 0x01, 0x02, 0x03, 0x04,
+	};
+	static const u8 short_block[] = {
+		0x00, 0x00, 0x00, 0x00, TAS3251_BOOK_DSP, 0x1c, 0x08, 4, 0x01, 0x02, 0x03,
+	};
+	struct tas3251_test_ctx *ctx = test->priv;
+	struct tas3251_test_bus *bus = ctx->bus;
+	unsigned int i;
+
+	tas3251_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, tas3251_test_coeffs_put(test, upload, sizeof(upload)), 0);
+	for (i = 0; i < 8; i++)
+		KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x1c, 0x08 + i), i + 1);
+	for (i = 0; i < 4; i++)
+		KUNIT_EXPECT_EQ(test, tas3251_test_reg(bus, TAS3251_BOOK_DSP, 0x30, 0x7c + i), 0xa1 + i);
+	KUNIT_EXPECT_LE(test, bus->xfers, 3 * 5);				// book, page, data, page
+	KUNIT_EXPECT_EQ(test, bus->swaps, 1);					// and book 0 for each
+	KUNIT_EXPECT_EQ(test, bus->book, TAS3251_BOOK_CTRL);			// block and the swap
+	KUNIT_EXPECT_EQ(test, bus->page, 0);
+	KUNIT_EXPECT_EQ(test, bus->stray, 0);
+	KUNIT_EXPECT_EQ(test, ctx->priv->active_cfg, -1);
+
+	/* Checked in full before anything is written */
+	tas3251_test_reset(bus);
+	KUNIT_EXPECT_EQ(test, tas3251_test_coeffs_put(test, book_ctrl, sizeof(book_ctrl)), -EINVAL);
+	KUNIT_EXPECT_EQ(test, tas3251_test_coeffs_put(test, page_end, sizeof(page_end)), -EINVAL);
+	KUNIT_EXPECT_EQ(test, tas3251_test_coeffs_put(test, short_block, sizeof(short_block)),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, bus->xfers, 0);
+}
+
+static struct kunit_case tas3251_test_cases[] = {
+	KUNIT_CASE(tas3251_test_compile_accept),
+	KUNIT_CASE(tas3251_test_compile_reject),
+	KUNIT_CASE(tas3251_test_container_reject),
+	KUNIT_CASE(tas3251_test_full_download),
+	KUNIT_CASE(tas3251_test_rate_switch),
+	KUNIT_CASE(tas3251_test_mute),
+	KUNIT_CASE(tas3251_test_format),
+	KUNIT_CASE(tas3251_test_volume),
+	KUNIT_CASE(tas3251_test_state_lost),
+	KUNIT_CASE(tas3251_test_meter),
+	KUNIT_CASE(tas3251_test_coeffs),
+	{ }
+};
+
+static struct kunit_suite tas3251_test_suite = {
+	.name		= "snd-soc-tas3251",
+	.init		= tas3251_test_init,
+	.exit		= tas3251_test_exit,
+	.test_cases	= tas3251_test_cases,
+};
+kunit_test_suite(tas3251_test_suite);
@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * TAS3251 ASoC codec driver tracepoints
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tas3251
+
+#if !defined(_TAS3251_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TAS3251_TRACE_H
+
+#include <linux/device.h>
+#include <linux/string.h>
+#include <linux/tracepoint.h>
+
+#define TAS3251_TRACE_NAME_LEN	32
+
+DECLARE_EVENT_CLASS(tas3251_fw_load,
+	TP_PROTO(struct device *dev, const char *fw_name, unsigned int rate,
+		 size_t size, unsigned int ops, int ret),
+	TP_ARGS(dev, fw_name, rate, size, ops, ret),
+	TP_STRUCT__entry(
+		__array(char, dev, TAS3251_TRACE_NAME_LEN)
+		__array(char, fw_name, 64)
+		__field(unsigned int, rate)
+		__field(size_t, size)
+		__field(unsigned int, ops)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		strscpy(__entry->dev, dev_name(dev), TAS3251_TRACE_NAME_LEN);
+		strscpy(__entry->fw_name, fw_name, 64);
+		__entry->rate = rate;
+		__entry->size = size;
+		__entry->ops = ops;
+		__entry->ret = ret;
+	),
+	TP_printk("%s %s rate=%u size=%zu ops=%u ret=%d", __entry->dev, __entry->fw_name,
+		  __entry->rate, __entry->size, __entry->ops, __entry->ret)
+);
+
+DEFINE_EVENT(tas3251_fw_load, tas3251_fw_load_start,
+	TP_PROTO(struct device *dev, const char *fw_name, unsigned int rate,
+		 size_t size, unsigned int ops, int ret),
+	TP_ARGS(dev, fw_name, rate, size, ops, ret));
+
+DEFINE_EVENT(tas3251_fw_load, tas3251_fw_load_end,
+	TP_PROTO(struct device *dev, const char *fw_name, unsigned int rate,
+		 size_t size, unsigned int ops, int ret),
+	TP_ARGS(dev, fw_name, rate, size, ops, ret));
+
+DECLARE_EVENT_CLASS(tas3251_download,
+	TP_PROTO(struct device *dev, unsigned int rate, bool delta,
+		 unsigned int xfers, unsigned int bytes, int ret),
+	TP_ARGS(dev, rate, delta, xfers, bytes, ret),
+	TP_STRUCT__entry(
+		__array(char, dev, TAS3251_TRACE_NAME_LEN)
+		__field(unsigned int, rate)
+		__field(bool, delta)
+		__field(unsigned int, xfers)
+		__field(unsigned int, bytes)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		strscpy(__entry->dev, dev_name(dev), TAS3251_TRACE_NAME_LEN);
+		__entry->rate = rate;
+		__entry->delta = delta;
+		__entry->xfers = xfers;
+		__entry->bytes = bytes;
+		__entry->ret = ret;
+	),
+	TP_printk("%s rate=%u %s xfers=%u bytes=%u ret=%d", __entry->dev, __entry->rate,
+		  __entry->delta ? "delta" : "full", __entry->xfers, __entry->bytes, __entry->ret)
+);
+
+/* xfers is the number of ops on start */
+DEFINE_EVENT(tas3251_download, tas3251_download_start,
+	TP_PROTO(struct device *dev, unsigned int rate, bool delta,
+		 unsigned int xfers, unsigned int bytes, int ret),
+	TP_ARGS(dev, rate, delta, xfers, bytes, ret));
+
+DEFINE_EVENT(tas3251_download, tas3251_download_end,
+	TP_PROTO(struct device *dev, unsigned int rate, bool delta,
+		 unsigned int xfers, unsigned int bytes, int ret),
+	TP_ARGS(dev, rate, delta, xfers, bytes, ret));
+
+DECLARE_EVENT_CLASS(tas3251_segment,
+	TP_PROTO(struct device *dev, unsigned int type, unsigned int reg,
+		 unsigned int len, int ret),
+	TP_ARGS(dev, type, reg, len, ret),
+	TP_STRUCT__entry(
+		__array(char, dev, TAS3251_TRACE_NAME_LEN)
+		__field(unsigned int, type)
+		__field(unsigned int, reg)
+		__field(unsigned int, len)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		strscpy(__entry->dev, dev_name(dev), TAS3251_TRACE_NAME_LEN);
+		__entry->type = type;
+		__entry->reg = reg;
+		__entry->len = len;
+		__entry->ret = ret;
+	),
+	TP_printk("%s %s book=0x%02x page=0x%02x reg=0x%02x len=%u ret=%d", __entry->dev,
+		  __print_symbolic(__entry->type, { 0, "write" }, { 1, "bulk" }, { 2, "delay" }),
+		  (__entry->reg - 0x100) / 0x80 >> 8 & 0xff, (__entry->reg - 0x100) / 0x80 & 0xff,
+		  __entry->reg & 0x7f, __entry->len, __entry->ret)
+);
+
+/* len is in ms for a delay */
+DEFINE_EVENT(tas3251_segment, tas3251_segment_start,
+	TP_PROTO(struct device *dev, unsigned int type, unsigned int reg,
+		 unsigned int len, int ret),
+	TP_ARGS(dev, type, reg, len, ret));
+
+DEFINE_EVENT(tas3251_segment, tas3251_segment_end,
+	TP_PROTO(struct device *dev, unsigned int type, unsigned int reg,
+		 unsigned int len, int ret),
+	TP_ARGS(dev, type, reg, len, ret));
+
+DECLARE_EVENT_CLASS(tas3251_dai_op,
+	TP_PROTO(struct device *dev, unsigned int val, int ret),
+	TP_ARGS(dev, val, ret),
+	TP_STRUCT__entry(
+		__array(char, dev, TAS3251_TRACE_NAME_LEN)
+		__field(unsigned int, val)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		strscpy(__entry->dev, dev_name(dev), TAS3251_TRACE_NAME_LEN);
+		__entry->val = val;
+		__entry->ret = ret;
+	),
+	TP_printk("%s 0x%x ret=%d", __entry->dev, __entry->val, __entry->ret)
+);
+
+DEFINE_EVENT(tas3251_dai_op, tas3251_mute_start,
+	TP_PROTO(struct device *dev, unsigned int val, int ret),
+	TP_ARGS(dev, val, ret));
+
+DEFINE_EVENT(tas3251_dai_op, tas3251_mute_end,
+	TP_PROTO(struct device *dev, unsigned int val, int ret),
+	TP_ARGS(dev, val, ret));
+
+DEFINE_EVENT(tas3251_dai_op, tas3251_set_dai_fmt_start,
+	TP_PROTO(struct device *dev, unsigned int val, int ret),
+	TP_ARGS(dev, val, ret));
+
+DEFINE_EVENT(tas3251_dai_op, tas3251_set_dai_fmt_end,
+	TP_PROTO(struct device *dev, unsigned int val, int ret),
+	TP_ARGS(dev, val, ret));
+
+#endif /* _TAS3251_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tas3251_trace
+
+#include <trace/define_trace.h>
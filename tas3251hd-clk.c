@@ -15,8 +15,6 @@
  * General Public License for more details.
  */
 
-#define DEBUG
-
 #include <linux/clk-provider.h>
 #include <linux/clk.h>
 #include <linux/kernel.h>
@@ -26,9 +24,53 @@
 #include <linux/platform_device.h>
 #include <linux/i2c.h>
 #include <linux/regmap.h>
+#include <linux/rational.h>
+#include <linux/math64.h>
+#include <linux/iopoll.h>
+#include <linux/mutex.h>
+
+#include "tas3251hd-clk.h"
+
+#define CREATE_TRACE_POINTS
+#include "tas3251hd_clk_trace.h"
 
 #define PLL_RESET			1
-#define DEFAULT_RATE			44100
+#define DEFAULT_RATE			44100				// on PLLA
+#define ALT_RATE			48000				// on PLLB, locked at probe
+#define MIN_RATE			1000
+#define MAX_RATE			768000
+
+#define SI5351_XTAL			25000000
+#define SI5351_PLL_MAX			900000000
+#define SI5351_MSNA_MIN			15
+#define SI5351_MSNA_MAX			90
+#define SI5351_MS_MIN			8
+#define SI5351_MS_MAX			2048
+#define SI5351_MS_MIN_OUT		500000				// below, use R0_DIV
+#define SI5351_R_DIV_MAX		7				// divide by 128
+#define SI5351_FRAC_MAX			1048575				// 20 bit c
+#define SI5351_MSNA			0x1A				// MSNB follows at 0x22
+#define SI5351_CLK0_CTRL		0x10
+#define SI5351_MS_SRC_PLLB		0x20
+#define SI5351_MS0			0x2A
+#define SI5351_PLL_RST			0xB1
+#define SI5351_STATUS			0x00
+#define SI5351_SYS_INIT			0x80				// still initialising
+#define SI5351_LOL_A			0x20				// PLLA not locked
+#define SI5351_LOL_B			0x40				// PLLB not locked
+#define SI5351_PLLA_RST			0x2C
+#define SI5351_PLLB_RST			0x8C
+#define SI5351_POLL_US			1000
+#define SI5351_LOCK_TIMEOUT_US		100000
+
+#define MCLK_44K1			45158400
+#define MCLK_48K			49152000
+#define BCLK_PER_FRAME			64
+
+#define REGSET_LEN			17				// MSNx, MS0, PLLx_RST
+#define PLL_A				0				// 45.1584 MHz family
+#define PLL_B				1				// 49.152 MHz family and the rest
+#define REGSET_CACHE			8
 
 static struct reg_default common_pll_regs[] = {
 	{0x02, 0x53}, {0x03, 0xFE}, {0x07, 0x00}, {0x0F, 0x00},		// 2x MASKS, CLKx_OEB, I2C_REG, PLL
@@ -39,42 +81,96 @@ static struct reg_default common_pll_regs[] = {
 	{0x31, 0x00}, {0xB7, 0x92},					// MS0, XTAL_CL
 	{0xB1, 0xAC},							// PLLx_RST
 	};
-static struct reg_default dedicated_44k1_pll_regs[] = {
-	{0x1A, 0x3D}, {0x1B, 0x09}, {0x1E, 0xD6}, {0x20, 0x19},		// MSNA
-	{0x21, 0x7A}, {0x2B, 0x04}, {0x2D, 0x07}, {0x2E, 0xE0},		// MSNA, MS0, R0_DIV
-	{0xB1, 0xAC},							// PLLx_RST
-	};
-static struct reg_default dedicated_48k_pll_regs[] = {
-	{0x1A, 0x0C}, {0x1B, 0x35}, {0x1E, 0xF0}, {0x20, 0x09},		// MSNA
-	{0x21, 0x50}, {0x2B, 0x04}, {0x2D, 0x07}, {0x2E, 0x20},		// MSNA, MS0, R0_DIV
-	{0xB1, 0xAC},							// PLLx_RST
-	};
+/*
+ * struct clk_hifiberry_regset - computed SI5351 settings for one sample rate
+ * @rate: requested sample rate
+ * @actual: sample rate the settings produce
+ * @mclk: MCLK the codec divides down, before rounding
+ * @pll: PLL_A or PLL_B
+ * @pll4: 4 * PLL frequency the MSNx fraction approximates
+ * @den: MSNx fraction denominator c
+ * @regs: MSNx and MS0 parameters, PLL reset
+ */
+struct clk_hifiberry_regset {
+	unsigned long rate;
+	unsigned long actual;
+	unsigned long mclk;
+	unsigned int pll;
+	u64 pll4;
+	unsigned long den;
+	struct reg_default regs[REGSET_LEN];
+};
 
 /*
  * struct clk_hifiberry_drvdata - Common struct to the HiFiBerry DAC HD Clk
  * @hw: clk_hw for the common clk framework
+ * @cache: recently used register sets, reused round robin
+ * @lock: serialises set_rate against the trim, which runs outside the clk framework
+ * @trim: MCLK fine trim in ppb
+ * @pll4: untrimmed 4 * frequency of each PLL, 0 until programmed
+ * @den: MSNx denominator of each PLL, kept by the trim
+ * @base: MSNx of each PLL, untrimmed
+ * @msn: MSNx as programmed, to write only what a trim changes
+ * @ms0: MS0 as programmed
+ * @src: PLL feeding MS0, -1 until the first rate
+ * @ctrl_reg: control register of the MCLK output, holds the MS0 source
+ * @ctrl_val: its value with PLLA as source
  */
 struct clk_hifiberry_drvdata {
 	struct regmap *regmap;
 	struct clk *clk;
 	struct clk_hw hw;
 	unsigned long rate;
+	unsigned long mclk;
+	struct mutex lock;
+	int trim;
+	u64 pll4[2];
+	unsigned long den[2];
+	u8 base[2][8];
+	u8 msn[2][8];
+	u8 ms0[8];
+	int src;
+	unsigned int ctrl_reg;
+	unsigned int ctrl_val;
+	struct clk_hifiberry_regset cache[REGSET_CACHE];
+	unsigned int cache_next;
 };
 
 #define to_hifiberry_clk(_hw) \
 	container_of(_hw, struct clk_hifiberry_drvdata, hw)
 
+/* Runs of consecutive registers go out as one transfer each */
 static int clk_hifiberry_dachd_write_pll_regs(struct regmap *regmap,
 				struct reg_default *regs,			// {unsigned int reg; unsigned int def;};
 				int num)
 {
-	int i;
+	u8 buf[REGSET_LEN];
+	int i, n;
 	int ret = 0;
 
-	for (i = 0; i < num; i++) {
-		ret |= regmap_write(regmap, regs[i].reg, regs[i].def);
+	for (i = 0; (i < num) && !ret; i += n) {
+		for (n = 0; (i + n < num) && (n < ARRAY_SIZE(buf)) &&
+		     (regs[i + n].reg == regs[i].reg + n); n++)
+			buf[n] = regs[i + n].def;
+		if (n == 1)
+			ret = regmap_write(regmap, regs[i].reg, buf[0]);
+		else
+			ret = regmap_bulk_write(regmap, regs[i].reg, buf, n);
 	}
-		mdelay(10);
+	return ret;
+}
+
+/* Sleep until the device status shows no bits of mask, instead of a fixed delay */
+static int clk_hifiberry_dachd_wait(struct regmap *regmap, unsigned int mask)
+{
+	unsigned int val;
+	int ret;
+
+	ret = regmap_read_poll_timeout(regmap, SI5351_STATUS, val, !(val & mask),
+		SI5351_POLL_US, SI5351_LOCK_TIMEOUT_US);
+	if (ret)
+		dev_err(regmap_get_device(regmap), "SI5351 not ready, status 0x%02x: %d\n",
+			val, ret);
 	return ret;
 }
 
@@ -84,47 +180,326 @@ static unsigned long clk_hifiberry_dachd_recalc_rate(struct clk_hw *hw,
 	return to_hifiberry_clk(hw)->rate;
 }
 
-static long clk_hifiberry_dachd_round_rate(struct clk_hw *hw,
-	unsigned long rate, unsigned long *parent_rate)
+/*
+ * MCLK for a sample rate: the 45.1584 / 49.152 MHz of the standard families
+ * when it divides into 64 bit frames, else the largest multiple of the
+ * frame clock up to 49.152 MHz that the codec's BCLK divider can reach.
+ */
+static unsigned long clk_hifiberry_dachd_mclk(unsigned long rate)
 {
-	return rate;
+	unsigned long frame = rate * BCLK_PER_FRAME;
+
+	if (!(MCLK_44K1 % frame) && (MCLK_44K1 / frame <= 128))
+		return MCLK_44K1;
+	if (!(MCLK_48K % frame) && (MCLK_48K / frame <= 128))
+		return MCLK_48K;
+	return frame * min(MCLK_48K / frame, 128UL);
 }
 
+/* SI5351 a + b / c divider as P1, P2, P3 in register order */
+static void clk_hifiberry_dachd_encode(struct reg_default *regs, unsigned int base,
+	unsigned long a, unsigned long b, unsigned long c, unsigned int r_div)
+{
+	unsigned long p1 = 128 * a + (128 * b) / c - 512;
+	unsigned long p2 = 128 * b - c * ((128 * b) / c);
+	u8 val[8] = {
+		c >> 8, c, (r_div << 4) | ((p1 >> 16) & 0x03), p1 >> 8,
+		p1, ((c >> 12) & 0xf0) | ((p2 >> 16) & 0x0f), p2 >> 8, p2,
+	};
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		regs[i].reg = base + i;
+		regs[i].def = val[i];
+	}
+}
+
+/*
+ * MS0 takes the largest quarter step divider that keeps the PLL at or below
+ * 900 MHz, PLL/XTAL is approximated with a 20 bit fraction. For the
+ * standard rates this gives the frequencies of the former fixed tables
+ * exactly. The fraction is then scaled up to the widest denominator that
+ * fits 20 bits, which the trim keeps, so a trim only moves the numerator.
+ * Rates of the 45.1584 MHz family run on PLLA, all others on PLLB, so each
+ * family keeps the same PLL frequency and only MS0 differs within it.
+ */
+static int clk_hifiberry_dachd_calc(unsigned long rate,
+	struct clk_hifiberry_regset *set)
+{
+	unsigned long mclk, out, a, b, c, rem, scale;
+	unsigned int r_div = 0;
+	u64 ms4, pll4;
+
+	if ((rate < MIN_RATE) || (rate > MAX_RATE))
+		return -EINVAL;
+	mclk = clk_hifiberry_dachd_mclk(rate);
+	for (out = mclk; out < SI5351_MS_MIN_OUT; out <<= 1)
+		r_div++;
+	if (r_div > SI5351_R_DIV_MAX)
+		return -EINVAL;
+	ms4 = min_t(u64, div64_u64(4ULL * SI5351_PLL_MAX, out), 4 * SI5351_MS_MAX);
+	if (ms4 < 4 * SI5351_MS_MIN)
+		return -EINVAL;
+
+	pll4 = (u64)out * ms4;						// 4 * PLL
+	a = div64_u64(pll4, 4ULL * SI5351_XTAL);
+	rem = pll4 - (u64)a * 4 * SI5351_XTAL;
+	rational_best_approximation(rem, 4UL * SI5351_XTAL, SI5351_FRAC_MAX,
+		SI5351_FRAC_MAX, &b, &c);
+	if (b == c) {
+		a++;
+		b = 0;
+	}
+	if (!b)
+		c = 1;
+	if ((a < SI5351_MSNA_MIN) || (a > SI5351_MSNA_MAX))
+		return -EINVAL;
+	scale = SI5351_FRAC_MAX / c;					// widest denominator,
+	b *= scale;							// kept by the trim
+	c *= scale;
+
+	set->rate = rate;
+	set->mclk = mclk;
+	set->pll = (mclk == MCLK_44K1) ? PLL_A : PLL_B;
+	set->pll4 = pll4;
+	set->den = c;
+	set->actual = DIV_ROUND_CLOSEST_ULL(div64_u64(4ULL * SI5351_XTAL * (a * c + b),
+		(u64)c * ms4 << r_div) * rate, mclk);
+	clk_hifiberry_dachd_encode(&set->regs[0], SI5351_MSNA + 8 * set->pll, a, b, c, 0);
+	clk_hifiberry_dachd_encode(&set->regs[8], SI5351_MS0, ms4 / 4, ms4 % 4, 4, r_div);
+	set->regs[16].reg = SI5351_PLL_RST;
+	set->regs[16].def = set->pll ? SI5351_PLLB_RST : SI5351_PLLA_RST;
+	return 0;
+}
+
+/*
+ * Called under the clk framework's prepare lock, so is the cache. An entry
+ * is found by the requested rate and by the rate it produces, which is what
+ * set_rate is called with after determine_rate.
+ */
+static struct clk_hifiberry_regset *clk_hifiberry_dachd_regset(
+	struct clk_hifiberry_drvdata *drvdata, unsigned long rate)
+{
+	struct clk_hifiberry_regset *set;
+	int i;
+
+	if ((rate < MIN_RATE) || (rate > MAX_RATE))
+		return NULL;
+	for (i = 0; i < REGSET_CACHE; i++)
+		if (drvdata->cache[i].rate &&
+		    ((drvdata->cache[i].rate == rate) || (drvdata->cache[i].actual == rate)))
+			return &drvdata->cache[i];
+	set = &drvdata->cache[drvdata->cache_next];
+	set->rate = 0;
+	if (clk_hifiberry_dachd_calc(rate, set))
+		return NULL;
+	drvdata->cache_next = (drvdata->cache_next + 1) % REGSET_CACHE;
+	return set;
+}
+
+static int clk_hifiberry_dachd_determine_rate(struct clk_hw *hw,
+	struct clk_rate_request *req)
+{
+	struct clk_hifiberry_regset *set;
+
+	set = clk_hifiberry_dachd_regset(to_hifiberry_clk(hw), req->rate);
+	if (!set)
+		return -EINVAL;
+	req->rate = set->actual;
+	return 0;
+}
+
+/*
+ * Moves a PLL by drvdata->trim ppb on the MSNx denominator it was set up
+ * with, so P3 stays and a small trim changes the low P2 bytes, P1 only when
+ * it carries. The MSNx registers from the first one that changed are
+ * written as one transfer. A small step of the feedback divider is tracked
+ * by the PLL, so there is no reset and no relock wait. Called with
+ * drvdata->lock held.
+ */
+static int clk_hifiberry_dachd_apply_trim(struct clk_hifiberry_drvdata *drvdata,
+	unsigned int pll)
+{
+	struct reg_default regs[8];
+	unsigned long a, b, c = drvdata->den[pll];
+	unsigned int msn = SI5351_MSNA + 8 * pll;
+	u64 pll4, rem;
+	u8 buf[8];
+	int i, first = -1;
+
+	if (!drvdata->pll4[pll])
+		return 0;						// not programmed yet
+	pll4 = drvdata->pll4[pll] + div_s64((s64)drvdata->pll4[pll] * drvdata->trim,
+		1000000000);
+	a = div64_u64(pll4, 4ULL * SI5351_XTAL);
+	rem = pll4 - (u64)a * 4 * SI5351_XTAL;
+	b = DIV_ROUND_CLOSEST_ULL(rem * c, 4ULL * SI5351_XTAL);
+	if (b == c) {
+		a++;
+		b = 0;
+	}
+	if ((a < SI5351_MSNA_MIN) || (a > SI5351_MSNA_MAX))
+		return -ERANGE;
+	clk_hifiberry_dachd_encode(regs, msn, a, b, c, 0);
+
+	for (i = 0; i < ARRAY_SIZE(buf); i++) {
+		buf[i] = drvdata->trim ? regs[i].def : drvdata->base[pll][i];	// exact untrimmed set
+		if ((buf[i] != drvdata->msn[pll][i]) && (first < 0))
+			first = i;
+	}
+	if (first < 0)
+		return 0;
+	/* always up to the last register, a complete divider is taken there */
+	dev_dbg(regmap_get_device(drvdata->regmap), "trim %d ppb: MSN 0x%02x from 0x%02x\n",
+		drvdata->trim, msn, msn + first);
+	i = regmap_bulk_write(drvdata->regmap, msn + first, &buf[first],
+		ARRAY_SIZE(buf) - first);
+	if (!i)
+		memcpy(drvdata->msn[pll], buf, sizeof(buf));
+	return i;
+}
+
+/*
+ * Programs and relocks the PLL of a register set, unless it already runs
+ * at that frequency. Returns the number of registers written.
+ */
+static int clk_hifiberry_dachd_set_pll(struct clk_hifiberry_drvdata *drvdata,
+	struct clk_hifiberry_regset *set)
+{
+	unsigned int pll = set->pll;
+	int i, ret;
+
+	if (drvdata->pll4[pll] == set->pll4)
+		return 0;
+	ret = clk_hifiberry_dachd_write_pll_regs(drvdata->regmap, set->regs, 8);
+	if (!ret)
+		ret = regmap_write(drvdata->regmap, set->regs[16].reg, set->regs[16].def);
+	if (!ret)
+		ret = clk_hifiberry_dachd_wait(drvdata->regmap,
+			pll ? SI5351_LOL_B : SI5351_LOL_A);
+	if (ret) {
+		drvdata->pll4[pll] = 0;					// reprogram next time
+		return ret;
+	}
+	drvdata->pll4[pll] = set->pll4;
+	drvdata->den[pll] = set->den;
+	for (i = 0; i < ARRAY_SIZE(drvdata->msn[pll]); i++)
+		drvdata->base[pll][i] = drvdata->msn[pll][i] = set->regs[i].def;
+	return 9;
+}
+
+/*
+ * With both PLLs locked, a change of rate family only rewrites the MS0
+ * registers that differ and the MS0 source, without a PLL reset.
+ */
 static int clk_hifiberry_dachd_set_rate(struct clk_hw *hw,
 	unsigned long rate, unsigned long parent_rate)
 {
-	int ret;
+	int i, first = -1, ret;
+	unsigned int regs = 0;
 	struct clk_hifiberry_drvdata *drvdata = to_hifiberry_clk(hw);
-
-	switch (rate) {
-	case 44100:
-	case 88200:
-	case 176400:
-		ret = clk_hifiberry_dachd_write_pll_regs(drvdata->regmap,
-			dedicated_44k1_pll_regs, ARRAY_SIZE(dedicated_44k1_pll_regs));
-		break;
-	case 32000:
-	case 48000:
-	case 96000:
-	case 192000:
-		ret = clk_hifiberry_dachd_write_pll_regs(drvdata->regmap,
-			dedicated_48k_pll_regs, ARRAY_SIZE(dedicated_48k_pll_regs));
-		break;
-	default:
-		ret = -EINVAL;
-		break;
+	struct clk_hifiberry_regset *set;
+	u8 buf[8];
+
+	trace_clk_hifiberry_dachd_set_rate_start(rate, 0, 0);
+	mutex_lock(&drvdata->lock);
+	set = clk_hifiberry_dachd_regset(drvdata, rate);
+	ret = set ? clk_hifiberry_dachd_set_pll(drvdata, set) : -EINVAL;
+	if (ret >= 0) {
+		regs = ret;
+		ret = clk_hifiberry_dachd_apply_trim(drvdata, set->pll);	// keep the trim across rates
+	}
+	if (!ret) {
+		for (i = 0; i < ARRAY_SIZE(buf); i++) {
+			buf[i] = set->regs[8 + i].def;
+			if (((buf[i] != drvdata->ms0[i]) || (drvdata->src < 0)) && (first < 0))
+				first = i;
+		}
+		if (first >= 0) {
+			ret = regmap_bulk_write(drvdata->regmap, SI5351_MS0 + first,
+				&buf[first], ARRAY_SIZE(buf) - first);
+			regs += ARRAY_SIZE(buf) - first;
+		}
+	}
+	if (!ret && (drvdata->src != set->pll)) {
+		ret = regmap_write(drvdata->regmap, drvdata->ctrl_reg, drvdata->ctrl_val |
+			(set->pll ? SI5351_MS_SRC_PLLB : 0));
+		regs++;
+	}
+	if (!ret) {
+		memcpy(drvdata->ms0, buf, sizeof(buf));
+		drvdata->src = set->pll;
+		drvdata->rate = set->actual;
+		drvdata->mclk = set->mclk;
+	} else {
+		drvdata->src = -1;					// rewrite all next time
 	}
-	to_hifiberry_clk(hw)->rate = rate;
+	mutex_unlock(&drvdata->lock);
+	trace_clk_hifiberry_dachd_set_rate_end(rate, regs, ret);
 
 	return ret;
 }
 
 const struct clk_ops clk_hifiberry_dachd_rate_ops = {
 	.recalc_rate = clk_hifiberry_dachd_recalc_rate,
-	.round_rate = clk_hifiberry_dachd_round_rate,
+	.determine_rate = clk_hifiberry_dachd_determine_rate,
 	.set_rate = clk_hifiberry_dachd_set_rate,
 };
 
+/**
+ * clk_hifiberry_dachd_get_mclk - MCLK behind the current sample rate
+ * @clk: the DAC+ HD clock
+ *
+ * The clock rate is the sample rate; the codec needs the MCLK it is divided
+ * from to set its dividers. Returns 0 before the first set_rate.
+ */
+unsigned long clk_hifiberry_dachd_get_mclk(struct clk *clk)
+{
+	struct clk_hw *hw = __clk_get_hw(clk);
+
+	return hw ? to_hifiberry_clk(hw)->mclk : 0;
+}
+EXPORT_SYMBOL_GPL(clk_hifiberry_dachd_get_mclk);
+
+/**
+ * clk_hifiberry_dachd_set_trim - fine trim of MCLK
+ * @clk: the DAC+ HD clock
+ * @ppb: offset from the nominal MCLK in parts per billion
+ *
+ * For drift compensation against another clock domain: the PLL in use is
+ * nudged by a few fractional MSNx registers, the output does not stop. The trim is kept
+ * across rate changes; the reported clock rate stays nominal.
+ */
+int clk_hifiberry_dachd_set_trim(struct clk *clk, int ppb)
+{
+	struct clk_hw *hw = __clk_get_hw(clk);
+	struct clk_hifiberry_drvdata *drvdata;
+	int old, ret;
+
+	if (!hw)
+		return -ENODEV;
+	if ((ppb < -CLK_HIFIBERRY_DACHD_TRIM_MAX) || (ppb > CLK_HIFIBERRY_DACHD_TRIM_MAX))
+		return -EINVAL;
+	drvdata = to_hifiberry_clk(hw);
+	mutex_lock(&drvdata->lock);
+	old = drvdata->trim;
+	drvdata->trim = ppb;
+	ret = (drvdata->src < 0) ? 0 : clk_hifiberry_dachd_apply_trim(drvdata, drvdata->src);
+	if (ret)
+		drvdata->trim = old;
+	mutex_unlock(&drvdata->lock);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(clk_hifiberry_dachd_set_trim);
+
+int clk_hifiberry_dachd_get_trim(struct clk *clk)
+{
+	struct clk_hw *hw = __clk_get_hw(clk);
+
+	return hw ? to_hifiberry_clk(hw)->trim : 0;
+}
+EXPORT_SYMBOL_GPL(clk_hifiberry_dachd_get_trim);
+
 static int clk_hifiberry_dachd_remove(struct device *dev)
 {
 	of_clk_del_provider(dev->of_node);
@@ -139,10 +514,10 @@ const struct regmap_config hifiberry_pll_regmap = {
 EXPORT_SYMBOL_GPL(hifiberry_pll_regmap);
 
 
-static int clk_hifiberry_dachd_i2c_probe(struct i2c_client *i2c,
-			     const struct i2c_device_id *id)
+static int clk_hifiberry_dachd_i2c_probe(struct i2c_client *i2c)
 {
 	struct clk_hifiberry_drvdata *hdclk;
+	struct clk_hifiberry_regset *set;
 	int ret = 0;
 	u32 i2c_reg, clkout = 0;
 	struct clk_init_data init;
@@ -156,6 +531,8 @@ static int clk_hifiberry_dachd_i2c_probe(struct i2c_client *i2c,
 		return -ENOMEM;
 
 	i2c_set_clientdata(i2c, hdclk);
+	mutex_init(&hdclk->lock);
+	hdclk->src = -1;
 
 	hdclk->regmap = devm_regmap_init_i2c(i2c, &config);
 
@@ -181,14 +558,28 @@ static int clk_hifiberry_dachd_i2c_probe(struct i2c_client *i2c,
 			}
 		dev_dbg(dev, "MCLK Output: OUT%d", clkout);
 	}
+	if (clkout > 2)
+		clkout = 0;
+	hdclk->ctrl_reg = SI5351_CLK0_CTRL + clkout;
+	hdclk->ctrl_val = common_pll_regs[4 + clkout].def;
 
-	/* restart PLL */
+	ret = clk_hifiberry_dachd_wait(hdclk->regmap, SI5351_SYS_INIT);
+	if (ret)
+		return ret;
+
+	/* restart PLL, clk_set_rate below waits for the lock */
 	ret = clk_hifiberry_dachd_write_pll_regs(hdclk->regmap, common_pll_regs,
 					ARRAY_SIZE(common_pll_regs));
 //	dev_dbg(dev, "Size common_pll_regs = %lu", ARRAY_SIZE(common_pll_regs));
 	if (ret)
 		return ret;
 
+	/* PLLB for the other family, so a family change needs no relock */
+	set = clk_hifiberry_dachd_regset(hdclk, ALT_RATE);
+	ret = set ? clk_hifiberry_dachd_set_pll(hdclk, set) : -EINVAL;
+	if (ret < 0)
+		return ret;
+
 	init.name = "clk-hifiberry-dachd";
 	init.ops = &clk_hifiberry_dachd_rate_ops;
 	init.flags = 0;
@@ -251,3 +642,7 @@ MODULE_DESCRIPTION("HiFiBerry DAC+ HD clock driver");
 MODULE_AUTHOR("Joerg Schambacher <joerg@i2audio.com>");
 MODULE_LICENSE("GPL v2");
 MODULE_ALIAS("platform:clk-hifiberry-dachd");
+
+#if IS_ENABLED(CONFIG_SND_SOC_TAS3251HD_CLK_KUNIT_TEST)
+#include "tas3251hd_clk_test.c"
+#endif
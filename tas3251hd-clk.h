@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Clock Driver for HiFiBerry DAC+ HD, interface for the machine driver
+ */
+
+#ifndef _TAS3251HD_CLK_H
+#define _TAS3251HD_CLK_H
+
+struct clk;
+
+#define CLK_HIFIBERRY_DACHD_TRIM_MAX	200000		/* ppb */
+
+unsigned long clk_hifiberry_dachd_get_mclk(struct clk *clk);
+int clk_hifiberry_dachd_set_trim(struct clk *clk, int ppb);
+int clk_hifiberry_dachd_get_trim(struct clk *clk);
+
+#endif /* _TAS3251HD_CLK_H */
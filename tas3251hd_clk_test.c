@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KUnit tests for the HiFiBerry DAC+ HD clock. Built as part of
+ * tas3251hd-clk.c, so the static helpers can be called directly.
+ *
+ * The regmap runs on a fake SI5351 that is always locked. It records the
+ * registers each transfer writes, so the tests can check which MSNx bytes a
+ * trim or a rate change puts on the wire.
+ */
+
+#include <kunit/device.h>
+#include <kunit/test.h>
+#include <linux/bitmap.h>
+
+#define CLK_HIFIBERRY_TEST_REGS		256
+#define CLK_HIFIBERRY_TEST_RATE		22222				// in neither family
+
+struct clk_hifiberry_test_bus {
+	u8 regs[CLK_HIFIBERRY_TEST_REGS];
+	DECLARE_BITMAP(written, CLK_HIFIBERRY_TEST_REGS);
+	unsigned int xfers;
+	unsigned int resets;						// PLL reset writes
+};
+
+struct clk_hifiberry_test_ctx {
+	struct clk_hifiberry_test_bus *bus;
+	struct clk_hifiberry_drvdata *drvdata;
+	struct clk *clk;
+};
+
+static int clk_hifiberry_test_write(void *context, const void *data, size_t count)
+{
+	struct clk_hifiberry_test_bus *bus = context;
+	const u8 *buf = data;
+	unsigned int reg = buf[0];
+	size_t i;
+
+	bus->xfers++;
+	for (i = 1; i < count; i++, reg++) {
+		if (reg >= CLK_HIFIBERRY_TEST_REGS)
+			return -EIO;
+		if (reg == SI5351_STATUS)
+			continue;
+		bus->regs[reg] = buf[i];
+		set_bit(reg, bus->written);
+		if (reg == SI5351_PLL_RST)
+			bus->resets++;
+	}
+	return 0;
+}
+
+/* STATUS reads 0: initialised, both PLLs locked */
+static int clk_hifiberry_test_read(void *context, const void *reg_buf, size_t reg_size,
+				   void *val_buf, size_t val_size)
+{
+	struct clk_hifiberry_test_bus *bus = context;
+	unsigned int reg = *(const u8 *)reg_buf;
+
+	bus->xfers++;
+	if (reg + val_size > CLK_HIFIBERRY_TEST_REGS)
+		return -EIO;
+	memcpy(val_buf, &bus->regs[reg], val_size);
+	return 0;
+}
+
+static const struct regmap_bus clk_hifiberry_test_regmap_bus = {
+	.write	= clk_hifiberry_test_write,
+	.read	= clk_hifiberry_test_read,
+};
+
+static void clk_hifiberry_test_reset(struct clk_hifiberry_test_bus *bus)
+{
+	bitmap_zero(bus->written, CLK_HIFIBERRY_TEST_REGS);
+	bus->xfers = 0;
+	bus->resets = 0;
+}
+
+/* Registers from..to written since the last reset, none outside */
+static bool clk_hifiberry_test_written(struct clk_hifiberry_test_bus *bus,
+				       unsigned int from, unsigned int to)
+{
+	return (find_first_bit(bus->written, CLK_HIFIBERRY_TEST_REGS) >= from) &&
+	       (find_last_bit(bus->written, CLK_HIFIBERRY_TEST_REGS) <= to);
+}
+
+/*
+ * 128 * c * (a + b / c), the MSNx divider on P3 = c, from P1, P2 and P3 in
+ * register order
+ */
+static u64 clk_hifiberry_test_msn(const u8 *r, u32 *p3)
+{
+	u32 p1 = (r[2] & 0x03) << 16 | r[3] << 8 | r[4];
+	u32 p2 = (r[5] & 0x0f) << 16 | r[6] << 8 | r[7];
+
+	*p3 = (r[5] & 0xf0) << 12 | r[0] << 8 | r[1];
+	return (u64)(p1 + 512) * *p3 + p2;
+}
+
+/* As the probe, without the DT properties, on the DEFAULT_RATE */
+static int clk_hifiberry_test_init(struct kunit *test)
+{
+	struct clk_hifiberry_drvdata *drvdata;
+	struct clk_hifiberry_test_ctx *ctx;
+	struct clk_init_data init = {
+		.name	= "clk-hifiberry-dachd-test",
+		.ops	= &clk_hifiberry_dachd_rate_ops,
+	};
+	struct device *dev;
+
+	ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx);
+	ctx->bus = kunit_kzalloc(test, sizeof(*ctx->bus), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, ctx->bus);
+	drvdata = kunit_kzalloc(test, sizeof(*drvdata), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, drvdata);
+	ctx->drvdata = drvdata;
+	test->priv = ctx;
+
+	dev = kunit_device_register(test, "dachd-clk-test");
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, dev);
+	mutex_init(&drvdata->lock);
+	drvdata->src = -1;
+	drvdata->ctrl_reg = SI5351_CLK0_CTRL;
+	drvdata->ctrl_val = common_pll_regs[4].def;
+	drvdata->regmap = devm_regmap_init(dev, &clk_hifiberry_test_regmap_bus, ctx->bus,
+					   &hifiberry_pll_regmap);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, drvdata->regmap);
+	drvdata->hw.init = &init;
+	KUNIT_ASSERT_EQ(test, devm_clk_hw_register(dev, &drvdata->hw), 0);
+	ctx->clk = drvdata->hw.clk;
+	KUNIT_ASSERT_EQ(test, clk_set_rate(ctx->clk, DEFAULT_RATE), 0);
+	KUNIT_ASSERT_EQ(test, drvdata->src, PLL_A);
+	return 0;
+}
+
+/*
+ * A trim moves the P2 bytes of the PLL in use on the denominator it was set
+ * up with: P3 stays, the PLL is not reset, and trim 0 gives back the exact
+ * untrimmed divider.
+ */
+static void clk_hifiberry_test_trim(struct kunit *test)
+{
+	static const int ppb[] = { 100, -100, 1000, -1000 };
+	struct clk_hifiberry_test_ctx *ctx = test->priv;
+	struct clk_hifiberry_test_bus *bus = ctx->bus;
+	u8 *msn = &bus->regs[SI5351_MSNA], base[8];
+	u64 div, trimmed;
+	s64 step, want;
+	u32 den, p3;
+	int i;
+
+	memcpy(base, msn, sizeof(base));
+	div = clk_hifiberry_test_msn(base, &den);
+	KUNIT_ASSERT_EQ(test, den, ctx->drvdata->den[PLL_A]);
+	KUNIT_EXPECT_GT(test, den, SI5351_FRAC_MAX / 2);		// widest that fits
+
+	for (i = 0; i < ARRAY_SIZE(ppb); i++) {
+		clk_hifiberry_test_reset(bus);
+		KUNIT_ASSERT_EQ(test, clk_hifiberry_dachd_set_trim(ctx->clk, ppb[i]), 0);
+		trimmed = clk_hifiberry_test_msn(msn, &p3);
+		step = (s64)trimmed - (s64)div;
+		want = div_s64((s64)div * ppb[i], 1000000000);
+		KUNIT_EXPECT_EQ_MSG(test, p3, den, "%d ppb", ppb[i]);
+		KUNIT_EXPECT_LE_MSG(test, abs(step - want), 64, "%d ppb", ppb[i]);	// b rounds
+		KUNIT_EXPECT_TRUE_MSG(test, clk_hifiberry_test_written(bus, SI5351_MSNA + 5,
+								       SI5351_MSNA + 7),
+				      "%d ppb", ppb[i]);
+		KUNIT_EXPECT_EQ(test, bus->xfers, 1);
+		KUNIT_EXPECT_EQ(test, bus->resets, 0);
+	}
+
+	clk_hifiberry_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, clk_hifiberry_dachd_set_trim(ctx->clk, 0), 0);
+	KUNIT_EXPECT_MEMEQ(test, msn, base, sizeof(base));
+	KUNIT_EXPECT_TRUE(test, clk_hifiberry_test_written(bus, SI5351_MSNA + 5, SI5351_MSNA + 7));
+
+	/* The full range still keeps P3 */
+	KUNIT_ASSERT_EQ(test, clk_hifiberry_dachd_set_trim(ctx->clk,
+							   CLK_HIFIBERRY_DACHD_TRIM_MAX), 0);
+	clk_hifiberry_test_msn(msn, &p3);
+	KUNIT_EXPECT_EQ(test, p3, den);
+	KUNIT_EXPECT_EQ(test, bus->resets, 0);
+
+	clk_hifiberry_test_reset(bus);
+	KUNIT_EXPECT_EQ(test, clk_hifiberry_dachd_set_trim(ctx->clk,
+							   CLK_HIFIBERRY_DACHD_TRIM_MAX + 1), -EINVAL);
+	KUNIT_EXPECT_EQ(test, clk_hifiberry_dachd_get_trim(ctx->clk),
+			CLK_HIFIBERRY_DACHD_TRIM_MAX);
+	KUNIT_EXPECT_EQ(test, bus->xfers, 0);
+}
+
+/*
+ * The trim follows a change of rate family onto the other PLL, and the PLL
+ * left behind keeps its trimmed divider, so going back writes no MSNx.
+ */
+static void clk_hifiberry_test_trim_rates(struct kunit *test)
+{
+	struct clk_hifiberry_test_ctx *ctx = test->priv;
+	struct clk_hifiberry_drvdata *drvdata = ctx->drvdata;
+	struct clk_hifiberry_test_bus *bus = ctx->bus;
+	u64 div, trimmed;
+	u32 den, p3;
+
+	KUNIT_ASSERT_EQ(test, clk_hifiberry_dachd_set_trim(ctx->clk, 1000), 0);
+	KUNIT_ASSERT_EQ(test, clk_set_rate(ctx->clk, ALT_RATE), 0);
+	KUNIT_ASSERT_EQ(test, drvdata->src, PLL_B);
+	div = clk_hifiberry_test_msn(drvdata->base[PLL_B], &den);
+	trimmed = clk_hifiberry_test_msn(&bus->regs[SI5351_MSNA + 8], &p3);
+	KUNIT_EXPECT_EQ(test, p3, den);
+	KUNIT_EXPECT_LE(test, abs((s64)trimmed - (s64)div - div_s64((s64)div * 1000, 1000000000)),
+			64);
+
+	clk_hifiberry_test_reset(bus);
+	KUNIT_ASSERT_EQ(test, clk_set_rate(ctx->clk, DEFAULT_RATE), 0);
+	KUNIT_EXPECT_EQ(test, drvdata->src, PLL_A);
+	KUNIT_EXPECT_EQ(test, bus->resets, 0);
+	KUNIT_EXPECT_TRUE(test, clk_hifiberry_test_written(bus, SI5351_CLK0_CTRL, SI5351_MS0 + 7));
+	KUNIT_EXPECT_GE(test, find_next_bit(bus->written, CLK_HIFIBERRY_TEST_REGS, SI5351_MSNA),
+			SI5351_MS0);						// no MSNx
+	KUNIT_EXPECT_EQ(test, clk_get_rate(ctx->clk), DEFAULT_RATE);
+}
+
+/*
+ * determine_rate and set_rate find the same register set, so a rate change
+ * computes one, and setting the rate again computes none.
+ */
+static void clk_hifiberry_test_rounded_rate(struct kunit *test)
+{
+	struct clk_hifiberry_test_ctx *ctx = test->priv;
+	struct clk_hifiberry_drvdata *drvdata = ctx->drvdata;
+	unsigned int i, n = 0;
+
+	KUNIT_ASSERT_EQ(test, clk_set_rate(ctx->clk, CLK_HIFIBERRY_TEST_RATE), 0);
+	KUNIT_EXPECT_EQ(test, drvdata->src, PLL_B);
+	KUNIT_ASSERT_EQ(test, clk_set_rate(ctx->clk, CLK_HIFIBERRY_TEST_RATE), 0);
+	for (i = 0; i < REGSET_CACHE; i++)
+		n += !!drvdata->cache[i].rate;
+	KUNIT_EXPECT_EQ(test, n, 2);						// and DEFAULT_RATE
+	KUNIT_EXPECT_EQ(test, drvdata->rate, clk_get_rate(ctx->clk));
+	KUNIT_EXPECT_EQ(test, (unsigned long)clk_round_rate(ctx->clk, CLK_HIFIBERRY_TEST_RATE),
+			clk_get_rate(ctx->clk));
+}
+
+static struct kunit_case clk_hifiberry_test_cases[] = {
+	KUNIT_CASE(clk_hifiberry_test_trim),
+	KUNIT_CASE(clk_hifiberry_test_trim_rates),
+	KUNIT_CASE(clk_hifiberry_test_rounded_rate),
+	{ }
+};
+
+static struct kunit_suite clk_hifiberry_test_suite = {
+	.name		= "clk-hifiberry-dachd",
+	.init		= clk_hifiberry_test_init,
+	.test_cases	= clk_hifiberry_test_cases,
+};
+kunit_test_suite(clk_hifiberry_test_suite);
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * HiFiBerry DAC+ HD clock driver tracepoints
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tas3251hd_clk
+
+#if !defined(_TAS3251HD_CLK_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TAS3251HD_CLK_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(tas3251hd_clk_set_rate,
+	TP_PROTO(unsigned long rate, unsigned int regs, int ret),
+	TP_ARGS(rate, regs, ret),
+	TP_STRUCT__entry(
+		__field(unsigned long, rate)
+		__field(unsigned int, regs)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->rate = rate;
+		__entry->regs = regs;
+		__entry->ret = ret;
+	),
+	TP_printk("rate=%lu regs=%u ret=%d", __entry->rate, __entry->regs, __entry->ret)
+);
+
+DEFINE_EVENT(tas3251hd_clk_set_rate, clk_hifiberry_dachd_set_rate_start,
+	TP_PROTO(unsigned long rate, unsigned int regs, int ret),
+	TP_ARGS(rate, regs, ret));
+
+/* regs is the number of register writes issued */
+DEFINE_EVENT(tas3251hd_clk_set_rate, clk_hifiberry_dachd_set_rate_end,
+	TP_PROTO(unsigned long rate, unsigned int regs, int ret),
+	TP_ARGS(rate, regs, ret));
+
+#endif /* _TAS3251HD_CLK_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tas3251hd_clk_trace
+
+#include <trace/define_trace.h>